@@ -0,0 +1,288 @@
+#include "ArrayKernels.h"
+#include <string.h>
+#include <limits>
+#include <algorithm>
+
+namespace xerxzema
+{
+
+WorkerPool::WorkerPool(size_t workers) : job(nullptr), job_count(0), active(0),
+										 generation(0), stopping(false)
+{
+	next.store(0);
+	remaining.store(0);
+	for(size_t i = 0; i < workers; i++)
+	{
+		threads.emplace_back(&WorkerPool::work, this);
+	}
+}
+
+WorkerPool::~WorkerPool()
+{
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		stopping = true;
+	}
+	wake.notify_all();
+	for(auto& t: threads)
+	{
+		t.join();
+	}
+}
+
+void WorkerPool::drain(const std::function<void(size_t)>* fn, size_t count)
+{
+	size_t i;
+	while((i = next++) < count)
+	{
+		(*fn)(i);
+		if(--remaining == 0)
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			finished.notify_all();
+		}
+	}
+}
+
+void WorkerPool::work()
+{
+	uint64_t seen = 0;
+	while(true)
+	{
+		std::unique_lock<std::mutex> guard(lock);
+		wake.wait(guard, [&]() { return stopping || generation != seen; });
+		if(stopping)
+			return;
+		seen = generation;
+		auto fn = job;
+		auto count = job_count;
+		active++;
+		guard.unlock();
+
+		drain(fn, count);
+
+		guard.lock();
+		active--;
+		finished.notify_all();
+	}
+}
+
+void WorkerPool::run(size_t count, const std::function<void(size_t)>& fn)
+{
+	std::lock_guard<std::mutex> run_guard(run_lock);
+	{
+		//a worker still draining the last job would pick up indices from this one
+		std::unique_lock<std::mutex> guard(lock);
+		finished.wait(guard, [&]() { return active == 0; });
+		job = &fn;
+		job_count = count;
+		next.store(0);
+		remaining.store(count);
+		generation++;
+	}
+	wake.notify_all();
+
+	drain(&fn, count);
+
+	std::unique_lock<std::mutex> guard(lock);
+	finished.wait(guard, [&]() { return remaining.load() == 0 && active == 0; });
+}
+
+static std::atomic<int64_t> threshold(1 << 16);
+
+void parallel_threshold(int64_t elements)
+{
+	threshold.store(elements);
+}
+
+int64_t parallel_threshold()
+{
+	return threshold.load();
+}
+
+//the scheduler thread is one of the participants so leave it a core
+static WorkerPool& worker_pool()
+{
+	static WorkerPool pool(std::max(1u, std::thread::hardware_concurrency()) - 1);
+	return pool;
+}
+
+//8 doubles is one avx-512 register, the compiler splits it for narrower hosts
+typedef double lanes __attribute__((vector_size(64)));
+static const int64_t lane_count = 8;
+static const int64_t block_size = 4096;
+
+//unaligned load, the arrays only guarantee malloc alignment
+static inline void load_lanes(lanes& v, const double* p)
+{
+	memcpy(&v, p, sizeof(v));
+}
+
+static inline double combine_lanes(const lanes& v)
+{
+	return ((v[0] + v[1]) + (v[2] + v[3])) + ((v[4] + v[5]) + (v[6] + v[7]));
+}
+
+struct SumKernel
+{
+	static double identity() { return 0; }
+	static double combine(double a, double b) { return a + b; }
+	static double block(const double* data, const double*, int64_t size)
+	{
+		lanes acc = {0, 0, 0, 0, 0, 0, 0, 0};
+		int64_t i = 0;
+		lanes x;
+		for(; i + lane_count <= size; i += lane_count)
+		{
+			load_lanes(x, data + i);
+			acc += x;
+		}
+		double result = combine_lanes(acc);
+		for(; i < size; i++)
+			result += data[i];
+		return result;
+	}
+};
+
+struct DotKernel
+{
+	static double identity() { return 0; }
+	static double combine(double a, double b) { return a + b; }
+	static double block(const double* lhs, const double* rhs, int64_t size)
+	{
+		lanes acc = {0, 0, 0, 0, 0, 0, 0, 0};
+		int64_t i = 0;
+		lanes x, y;
+		for(; i + lane_count <= size; i += lane_count)
+		{
+			load_lanes(x, lhs + i);
+			load_lanes(y, rhs + i);
+			acc += x * y;
+		}
+		double result = combine_lanes(acc);
+		for(; i < size; i++)
+			result += lhs[i] * rhs[i];
+		return result;
+	}
+};
+
+struct MinKernel
+{
+	static double identity() { return std::numeric_limits<double>::infinity(); }
+	static double combine(double a, double b) { return b < a ? b : a; }
+	static double block(const double* data, const double*, int64_t size)
+	{
+		double acc[lane_count];
+		std::fill(acc, acc + lane_count, identity());
+		int64_t i = 0;
+		for(; i + lane_count <= size; i += lane_count)
+		{
+			for(int64_t k = 0; k < lane_count; k++)
+				acc[k] = combine(acc[k], data[i + k]);
+		}
+		double result = identity();
+		for(int64_t k = 0; k < lane_count; k++)
+			result = combine(result, acc[k]);
+		for(; i < size; i++)
+			result = combine(result, data[i]);
+		return result;
+	}
+};
+
+struct MaxKernel
+{
+	static double identity() { return -std::numeric_limits<double>::infinity(); }
+	static double combine(double a, double b) { return b > a ? b : a; }
+	static double block(const double* data, const double*, int64_t size)
+	{
+		double acc[lane_count];
+		std::fill(acc, acc + lane_count, identity());
+		int64_t i = 0;
+		for(; i + lane_count <= size; i += lane_count)
+		{
+			for(int64_t k = 0; k < lane_count; k++)
+				acc[k] = combine(acc[k], data[i + k]);
+		}
+		double result = identity();
+		for(int64_t k = 0; k < lane_count; k++)
+			result = combine(result, acc[k]);
+		for(; i < size; i++)
+			result = combine(result, data[i]);
+		return result;
+	}
+};
+
+template<class K>
+static double block_result(const double* lhs, const double* rhs, int64_t size, int64_t block)
+{
+	auto first = block * block_size;
+	auto count = std::min(block_size, size - first);
+	return K::block(lhs + first, rhs ? rhs + first : nullptr, count);
+}
+
+//both the serial and the parallel path go through this tree
+template<class K, class F>
+static double pairwise(int64_t first, int64_t last, const F& leaf)
+{
+	if(last - first == 1)
+		return leaf(first);
+	auto mid = first + (last - first) / 2;
+	return K::combine(pairwise<K>(first, mid, leaf), pairwise<K>(mid, last, leaf));
+}
+
+template<class K>
+static double reduce(const double* lhs, const double* rhs, int64_t size)
+{
+	if(size <= 0)
+		return K::identity();
+
+	auto blocks = (size + block_size - 1) / block_size;
+	auto& pool = worker_pool();
+	if(size < parallel_threshold() || blocks < 2 || pool.size() < 2)
+	{
+		return pairwise<K>(0, blocks, [&](int64_t b)
+						   {
+							   return block_result<K>(lhs, rhs, size, b);
+						   });
+	}
+
+	std::vector<double> partials(blocks);
+	auto tasks = std::min<size_t>(pool.size(), blocks);
+	pool.run(tasks, [&](size_t task)
+			 {
+				 auto first = blocks * task / tasks;
+				 auto last = blocks * (task + 1) / tasks;
+				 for(auto b = first; b < last; b++)
+					 partials[b] = block_result<K>(lhs, rhs, size, b);
+			 });
+	return pairwise<K>(0, blocks, [&](int64_t b) { return partials[b]; });
+}
+
+double array_sum(const double* data, int64_t size)
+{
+	return reduce<SumKernel>(data, nullptr, size);
+}
+
+double array_dot(const double* lhs, const double* rhs, int64_t size)
+{
+	return reduce<DotKernel>(lhs, rhs, size);
+}
+
+double array_min(const double* data, int64_t size)
+{
+	return reduce<MinKernel>(data, nullptr, size);
+}
+
+double array_max(const double* data, int64_t size)
+{
+	return reduce<MaxKernel>(data, nullptr, size);
+}
+
+double array_mean(const double* data, int64_t size)
+{
+	if(size <= 0)
+		return std::numeric_limits<double>::quiet_NaN();
+	return array_sum(data, size) / size;
+}
+
+};
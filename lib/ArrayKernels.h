@@ -0,0 +1,54 @@
+#pragma once
+#include <stdint.h>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+namespace xerxzema
+{
+
+//fork-join pool for the array kernels. run() hands out task indices to the
+//workers and the calling thread and returns once every task is done.
+class WorkerPool
+{
+public:
+	WorkerPool(size_t workers);
+	~WorkerPool();
+	void run(size_t count, const std::function<void(size_t)>& fn);
+	inline size_t size() { return threads.size() + 1; }
+private:
+	void work();
+	void drain(const std::function<void(size_t)>* fn, size_t count);
+
+	std::vector<std::thread> threads;
+	std::mutex run_lock;
+	std::mutex lock;
+	std::condition_variable wake;
+	std::condition_variable finished;
+	const std::function<void(size_t)>* job;
+	size_t job_count;
+	std::atomic<size_t> next;
+	std::atomic<size_t> remaining;
+	size_t active;
+	uint64_t generation;
+	bool stopping;
+};
+
+//arrays with at least this many elements get split across the worker pool
+void parallel_threshold(int64_t elements);
+int64_t parallel_threshold();
+
+//the reductions always sum fixed size blocks and combine the block results
+//pairwise in the same tree, so the answer is the same bit for bit no matter
+//how many threads worked on it or whether it went parallel at all.
+//empty arrays give 0 for sum/dot, +inf for min, -inf for max and nan for mean.
+double array_sum(const double* data, int64_t size);
+double array_dot(const double* lhs, const double* rhs, int64_t size);
+double array_min(const double* data, int64_t size);
+double array_max(const double* data, int64_t size);
+double array_mean(const double* data, int64_t size);
+
+};
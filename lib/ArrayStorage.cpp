@@ -0,0 +1,107 @@
+#include "ArrayStorage.h"
+#include <stdlib.h>
+#include <string.h>
+#include <new>
+
+namespace xerxzema
+{
+
+static inline ArrayHeader* header(const ArrayValue* array)
+{
+	return (ArrayHeader*)array->data - 1;
+}
+
+static inline bool is_owned(const ArrayValue* array)
+{
+	return array->alloc > 0;
+}
+
+static inline bool is_inline(const ArrayValue* array)
+{
+	return array->alloc == array_inline;
+}
+
+static void* allocate(ArrayValue* array, int64_t size, int64_t element_size)
+{
+	auto h = (ArrayHeader*)malloc(sizeof(ArrayHeader) + size * element_size);
+	new (&h->refs) std::atomic<int64_t>(1);
+	array->data = h + 1;
+	array->size = size;
+	array->alloc = size;
+	return array->data;
+}
+
+void* array_reserve(ArrayValue* array, int64_t size, int64_t element_size)
+{
+	if(is_owned(array) && array->alloc >= size && header(array)->refs.load() == 1)
+	{
+		array->size = size;
+		return array->data;
+	}
+	array_release(array);
+	if(size <= 0)
+		return nullptr;
+	if(size * element_size <= array_inline_bytes)
+	{
+		array->data = array->inline_data;
+		array->size = size;
+		array->alloc = array_inline;
+		return array->data;
+	}
+	return allocate(array, size, element_size);
+}
+
+void* array_make_unique(ArrayValue* array, int64_t element_size)
+{
+	if(is_owned(array) && header(array)->refs.load() == 1)
+		return array->data;
+	//inline arrays are never shared, the struct might have been copied though
+	if(is_inline(array))
+	{
+		array->data = array->inline_data;
+		return array->data;
+	}
+	if(array->size <= 0)
+	{
+		array_release(array);
+		return nullptr;
+	}
+
+	ArrayValue unique;
+	allocate(&unique, array->size, element_size);
+	memcpy(unique.data, array->data, array->size * element_size);
+	array_release(array);
+	*array = unique;
+	return array->data;
+}
+
+void array_retain(ArrayValue* array)
+{
+	if(is_owned(array))
+		header(array)->refs.fetch_add(1, std::memory_order_relaxed);
+}
+
+void array_release(ArrayValue* array)
+{
+	if(is_owned(array) && header(array)->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+		free(header(array));
+	array->data = nullptr;
+	array->size = 0;
+	array->alloc = 0;
+}
+
+int64_t array_refs(const ArrayValue* array)
+{
+	if(!is_owned(array))
+		return 0;
+	return header(array)->refs.load();
+}
+
+void array_assign(ArrayValue* dst, const ArrayValue& src)
+{
+	*dst = src;
+	if(is_inline(dst))
+		dst->data = dst->inline_data;
+}
+
+};
@@ -0,0 +1,56 @@
+#pragma once
+#include <stdint.h>
+#include <atomic>
+
+namespace xerxzema
+{
+
+//arrays of up to this many bytes live inside the register itself
+static const int64_t array_inline_bytes = 16;
+//alloc value of an array stored in inline_data
+static const int64_t array_inline = -1;
+
+//what an array.T register holds, see Array::type. data always points at the
+//elements, for inline arrays that is the array's own inline_data so anything
+//that copies the struct has to point it at the new inline_data.
+struct ArrayValue
+{
+	void* data;
+	int64_t size;
+	int64_t alloc;
+	uint8_t inline_data[array_inline_bytes];
+};
+
+//owned buffers are allocated with this in front of the data. alloc is the
+//capacity in elements, 0 means the array doesn't own any memory: it's either
+//empty or borrows a constant global (string and array literals).
+//array_inline means the elements are in inline_data.
+//16 bytes so the elements keep malloc alignment.
+struct ArrayHeader
+{
+	std::atomic<int64_t> refs;
+	int64_t reserved;
+};
+
+//registers share buffers by reference count instead of copying them. anything
+//that writes into an array goes through array_reserve or array_make_unique
+//first, which hand back a buffer nobody else can see (copy on write).
+
+//makes a buffer of at least size elements that only this array references and
+//sets the size. the old contents are not kept, callers overwrite all of them.
+//small arrays go inline instead of the heap unless there is a buffer to reuse.
+void* array_reserve(ArrayValue* array, int64_t size, int64_t element_size);
+//same as array_reserve(array->size) but keeps the contents
+void* array_make_unique(ArrayValue* array, int64_t element_size);
+void array_retain(ArrayValue* array);
+//drops this reference and leaves the array empty
+void array_release(ArrayValue* array);
+//number of arrays sharing the buffer, 0 when the array doesn't own a heap buffer
+int64_t array_refs(const ArrayValue* array);
+//copies src into dst the way the jitted code copies array registers: inline
+//arrays get data pointed at dst's own inline_data. no reference is taken, host
+//code copying arrays in and out of program state should use this instead of
+//plain struct assignment.
+void array_assign(ArrayValue* dst, const ArrayValue& src);
+
+};
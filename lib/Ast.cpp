@@ -35,6 +35,20 @@ void RealExpression::accept(xerxzema::AstVisitor &v)
 	v.visit(this);
 }
 
+IntExpression::IntExpression(std::unique_ptr<Token>&& t) : Expression(std::move(t))
+{
+}
+
+std::string IntExpression::show()
+{
+	return "(int " + token->data + ")";
+}
+
+void IntExpression::accept(xerxzema::AstVisitor &v)
+{
+	v.visit(this);
+}
+
 StringExpression::StringExpression(std::unique_ptr<Token>&& t) : Expression(std::move(t))
 {
 }
@@ -569,6 +583,10 @@ void AstVisitor::visit(RealExpression *e)
 {
 	handle_default(e);
 }
+void AstVisitor::visit(IntExpression *e)
+{
+	handle_default(e);
+}
 void AstVisitor::visit(StringExpression *e)
 {
 	handle_default(e);
@@ -94,6 +94,14 @@ public:
 	void accept(AstVisitor& v);
 };
 
+class IntExpression : public Expression
+{
+public:
+	IntExpression(std::unique_ptr<Token>&& token);
+	std::string show();
+	void accept(AstVisitor& v);
+};
+
 class StringExpression : public Expression
 {
 public:
@@ -350,6 +358,7 @@ public:
 	virtual void visit(CodeDefinition* e);
 	virtual void visit(SymbolExpression* e);
 	virtual void visit(RealExpression* e);
+	virtual void visit(IntExpression* e);
 	virtual void visit(StringExpression* e);
 	virtual void visit(AnnotationExpression* e);
 	virtual void visit(AddExpression* e);
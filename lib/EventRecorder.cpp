@@ -0,0 +1,191 @@
+#include "EventRecorder.h"
+#include "Diagnostics.h"
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+
+namespace xerxzema
+{
+
+static const char recording_magic[8] = {'x', 'z', 'e', 'v', 'e', 'n', 't', 1};
+
+static void noop_callback(void*)
+{
+}
+
+//how long the background thread sleeps between drains
+static const auto drain_period = std::chrono::milliseconds(5);
+
+EventRecorder::EventRecorder(FILE* file, bool background) :
+	pending(new PendingEvent[recorder_capacity]), file(file), _count(0)
+{
+	write.store(0);
+	read.store(0);
+	_dropped.store(0);
+	fwrite(recording_magic, sizeof(recording_magic), 1, file);
+	running.store(true);
+	if(background)
+		drain_thread = std::thread(&EventRecorder::drain_loop, this);
+}
+
+EventRecorder::~EventRecorder()
+{
+	running.store(false);
+	if(drain_thread.joinable())
+		drain_thread.join();
+	flush();
+}
+
+uint32_t EventRecorder::id(std::map<void*, uint32_t>& ids, void* ptr)
+{
+	auto found = ids.find(ptr);
+	if(found != ids.end())
+		return found->second;
+	uint32_t next = ids.size();
+	ids[ptr] = next;
+	return next;
+}
+
+void EventRecorder::record(const CallbackData& task, uint64_t enqueued)
+{
+	auto head = write.load(std::memory_order_relaxed);
+	if(head - read.load(std::memory_order_acquire) == recorder_capacity)
+	{
+		_dropped.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+	auto& event = pending[head & (recorder_capacity - 1)];
+	event.enqueued = enqueued;
+	event.when = task.when;
+	event.period = task.period;
+	event.state = task.state;
+	event.callback = (void*)task.fn;
+	event.lane = (uint8_t)task.lane;
+	write.store(head + 1, std::memory_order_release);
+}
+
+size_t EventRecorder::drain()
+{
+	std::lock_guard<std::mutex> guard(lock);
+	auto tail = read.load(std::memory_order_relaxed);
+	auto head = write.load(std::memory_order_acquire);
+	for(auto i = tail; i < head; i++)
+	{
+		auto& p = pending[i & (recorder_capacity - 1)];
+		RecordedEvent event;
+		memset(&event, 0, sizeof(event));
+		event.enqueued = p.enqueued;
+		event.when = p.when;
+		event.period = p.period;
+		event.state = id(states, p.state);
+		event.callback = id(callbacks, p.callback);
+		event.lane = p.lane;
+		fwrite(&event, sizeof(event), 1, file);
+	}
+	read.store(head, std::memory_order_release);
+	_count += head - tail;
+	return head - tail;
+}
+
+void EventRecorder::drain_loop()
+{
+	while(running.load())
+	{
+		drain();
+		std::this_thread::sleep_for(drain_period);
+	}
+}
+
+void EventRecorder::flush()
+{
+	drain();
+	std::lock_guard<std::mutex> guard(lock);
+	fflush(file);
+}
+
+uint64_t EventRecorder::count()
+{
+	std::lock_guard<std::mutex> guard(lock);
+	return _count;
+}
+
+EventReplay::EventReplay()
+{
+	memset(&feeder, 0, sizeof(feeder));
+}
+
+bool EventReplay::load(FILE* file)
+{
+	char magic[sizeof(recording_magic)];
+	if(fread(magic, sizeof(magic), 1, file) != 1 ||
+	   memcmp(magic, recording_magic, sizeof(magic)))
+	{
+		emit_error("not a scheduler recording");
+		return false;
+	}
+
+	_events.clear();
+	RecordedEvent event;
+	uint32_t callback_count = 0;
+	uint32_t state_count = 0;
+	while(fread(&event, sizeof(event), 1, file) == 1)
+	{
+		callback_count = std::max<uint32_t>(callback_count, event.callback + 1);
+		state_count = std::max<uint32_t>(state_count, event.state + 1);
+		_events.push_back(event);
+	}
+	//the wall clock can step backwards while recording
+	std::stable_sort(_events.begin(), _events.end(),
+					 [](const RecordedEvent& lhs, const RecordedEvent& rhs)
+					 {
+						 return lhs.enqueued < rhs.enqueued;
+					 });
+
+	callbacks.assign(callback_count, noop_callback);
+	states.assign(state_count, CallbackState{});
+	return true;
+}
+
+void EventReplay::callback(uint32_t id, scheduler_callback fn)
+{
+	if(id < callbacks.size())
+		callbacks[id] = fn;
+}
+
+static uint64_t shifted(uint64_t time, int64_t shift)
+{
+	return shift < 0 && time < (uint64_t)-shift ? 0 : time + shift;
+}
+
+void EventReplay::replay(Scheduler* scheduler, uint64_t start)
+{
+	if(!_events.size())
+		return;
+	feeder.replay = this;
+	feeder.scheduler = scheduler;
+	feeder.next = 0;
+	feeder.shift = start - _events.front().enqueued;
+	scheduler->schedule(feed, &feeder, start, SchedulerLane::Realtime);
+}
+
+//submits everything recorded up to now then sleeps until the next enqueue time
+void EventReplay::feed(void* state)
+{
+	auto f = (Feeder*)state;
+	auto replay = f->replay;
+	auto& events = replay->_events;
+	auto current = f->header.exec_time;
+
+	while(f->next < events.size() && shifted(events[f->next].enqueued, f->shift) <= current)
+	{
+		auto& event = events[f->next++];
+		f->scheduler->submit(replay->callbacks[event.callback], &replay->states[event.state],
+							 shifted(event.when, f->shift), event.period,
+							 (SchedulerLane)event.lane);
+	}
+	if(f->next < events.size())
+		f->scheduler->schedule(feed, f, shifted(events[f->next].enqueued, f->shift),
+							   SchedulerLane::Realtime);
+}
+
+};
@@ -0,0 +1,113 @@
+#pragma once
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+#include <map>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <memory>
+#include "Scheduler.h"
+
+namespace xerxzema
+{
+
+//one schedule call as it is stored on disk. callbacks and states are numbered in
+//the order they were first seen, pointers mean nothing in another process.
+struct RecordedEvent
+{
+	//scheduler time the task was submitted at
+	uint64_t enqueued;
+	uint64_t when;
+	uint64_t period;
+	uint32_t state;
+	uint16_t callback;
+	uint8_t lane;
+	uint8_t reserved;
+};
+
+//events buffered between drains, a power of two
+static const uint64_t recorder_capacity = 16384;
+
+//writes every task submitted to a scheduler to a binary file, see Scheduler::record.
+//the scheduler calls record with its task lock held, so that's the one producer
+//of the ring and one recorder can only be attached to one scheduler at a time.
+//numbering and writing happen on the drain thread, a full ring drops the event
+//and counts it instead of holding up the scheduler.
+class EventRecorder
+{
+public:
+	EventRecorder(FILE* file, bool background = true);
+	~EventRecorder();
+	void record(const CallbackData& task, uint64_t enqueued);
+	//writes out everything recorded so far
+	void flush();
+	//events written to the file
+	uint64_t count();
+	//events lost to a full ring
+	inline uint64_t dropped() const { return _dropped.load(std::memory_order_relaxed); }
+private:
+	//what record leaves in the ring, pointers aren't numbered yet
+	struct PendingEvent
+	{
+		uint64_t enqueued;
+		uint64_t when;
+		uint64_t period;
+		void* state;
+		void* callback;
+		uint8_t lane;
+	};
+	uint32_t id(std::map<void*, uint32_t>& ids, void* ptr);
+	size_t drain();
+	void drain_loop();
+
+	std::unique_ptr<PendingEvent[]> pending;
+	std::atomic<uint64_t> write;
+	std::atomic<uint64_t> read;
+	std::atomic<uint64_t> _dropped;
+	std::mutex lock;
+	FILE* file;
+	std::map<void*, uint32_t> callbacks;
+	std::map<void*, uint32_t> states;
+	uint64_t _count;
+	std::atomic<bool> running;
+	std::thread drain_thread;
+};
+
+//feeds a recording back into a scheduler at the times it was originally
+//submitted, for benchmarking the queue and dispatch against a real workload.
+//works the same under real and offline time, the events are submitted by a
+//task on the realtime lane that wakes up at each recorded enqueue time.
+class EventReplay
+{
+public:
+	EventReplay();
+	//false when the file isn't a recording
+	bool load(FILE* file);
+	//what runs in place of a recorded callback, nothing by default.
+	//every replayed task gets a CallbackState of its own per recorded state.
+	void callback(uint32_t id, scheduler_callback fn);
+	//times are shifted so the first event is submitted at start
+	void replay(Scheduler* scheduler, uint64_t start);
+	inline const std::vector<RecordedEvent>& events() const { return _events; }
+	inline size_t callback_count() const { return callbacks.size(); }
+	inline size_t state_count() const { return states.size(); }
+	inline uint64_t submitted() const { return feeder.next; }
+private:
+	struct Feeder
+	{
+		CallbackState header;
+		EventReplay* replay;
+		Scheduler* scheduler;
+		size_t next;
+		int64_t shift;
+	};
+	static void feed(void* state);
+
+	std::vector<RecordedEvent> _events;
+	std::vector<scheduler_callback> callbacks;
+	std::vector<CallbackState> states;
+	Feeder feeder;
+};
+
+};
@@ -0,0 +1,106 @@
+#include "Histogram.h"
+#include <limits>
+#include <algorithm>
+
+namespace xerxzema
+{
+
+static const uint64_t sub_buckets = 32;
+static const uint64_t sub_bucket_bits = 5;
+
+Histogram::Histogram()
+{
+	reset();
+}
+
+size_t Histogram::bucket(uint64_t value)
+{
+	if(value < histogram_exact)
+		return value;
+	//keep the top 6 bits, the leading one picks the power of two
+	auto msb = 63 - __builtin_clzll(value);
+	auto shift = msb - sub_bucket_bits;
+	return histogram_exact + (shift - 1) * sub_buckets + ((value >> shift) - sub_buckets);
+}
+
+uint64_t Histogram::bucket_high(size_t index)
+{
+	if(index < histogram_exact)
+		return index;
+	auto k = index - histogram_exact;
+	auto shift = k / sub_buckets + 1;
+	auto sub = k % sub_buckets + sub_buckets;
+	return ((sub + 1) << shift) - 1;
+}
+
+void Histogram::record(uint64_t value)
+{
+	buckets[bucket(value)].fetch_add(1, std::memory_order_relaxed);
+	total.fetch_add(1, std::memory_order_relaxed);
+	sum.fetch_add(value, std::memory_order_relaxed);
+
+	auto low = _min.load(std::memory_order_relaxed);
+	while(value < low && !_min.compare_exchange_weak(low, value, std::memory_order_relaxed));
+	auto high = _max.load(std::memory_order_relaxed);
+	while(value > high && !_max.compare_exchange_weak(high, value, std::memory_order_relaxed));
+}
+
+uint64_t Histogram::count() const
+{
+	return total.load(std::memory_order_relaxed);
+}
+
+uint64_t Histogram::min() const
+{
+	return count() ? _min.load(std::memory_order_relaxed) : 0;
+}
+
+uint64_t Histogram::max() const
+{
+	return _max.load(std::memory_order_relaxed);
+}
+
+double Histogram::mean() const
+{
+	auto n = count();
+	return n ? (double)sum.load(std::memory_order_relaxed) / n : 0;
+}
+
+uint64_t Histogram::percentile(double p) const
+{
+	auto n = count();
+	if(!n)
+		return 0;
+	//rank of the wanted sample, at least the first one
+	uint64_t rank = p / 100.0 * n + 0.5;
+	rank = std::max<uint64_t>(rank, 1);
+	uint64_t seen = 0;
+	for(size_t i = 0; i < histogram_buckets; i++)
+	{
+		seen += buckets[i].load(std::memory_order_relaxed);
+		if(seen >= rank)
+			return std::min(bucket_high(i), max());
+	}
+	return max();
+}
+
+void Histogram::reset()
+{
+	for(auto& b: buckets)
+		b.store(0, std::memory_order_relaxed);
+	total.store(0);
+	sum.store(0);
+	_min.store(std::numeric_limits<uint64_t>::max());
+	_max.store(0);
+}
+
+void Histogram::dump(FILE* file, const std::string& name) const
+{
+	fprintf(file, "%s: count %llu min %llu mean %.1f p50 %llu p90 %llu p99 %llu p99.9 %llu max %llu\n",
+			name.c_str(), (unsigned long long)count(), (unsigned long long)min(), mean(),
+			(unsigned long long)percentile(50), (unsigned long long)percentile(90),
+			(unsigned long long)percentile(99), (unsigned long long)percentile(99.9),
+			(unsigned long long)max());
+}
+
+};
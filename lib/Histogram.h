@@ -0,0 +1,43 @@
+#pragma once
+#include <stdint.h>
+#include <stdio.h>
+#include <atomic>
+#include <string>
+
+namespace xerxzema
+{
+
+//values below this are counted exactly, above it every power of two is split
+//into 32 buckets so anything reported is within ~3% of what was recorded
+static const uint64_t histogram_exact = 64;
+static const size_t histogram_buckets = 64 + 58 * 32;
+
+//log-linear (hdr style) histogram of nanosecond timings or counts.
+//recording is lock free and can happen on any thread, readers see a
+//snapshot that may be a few records behind.
+class Histogram
+{
+public:
+	Histogram();
+	void record(uint64_t value);
+	uint64_t count() const;
+	uint64_t min() const;
+	uint64_t max() const;
+	double mean() const;
+	//the largest value in the bucket holding the p-th percentile (0-100)
+	uint64_t percentile(double p) const;
+	void reset();
+	void dump(FILE* file, const std::string& name) const;
+
+	static size_t bucket(uint64_t value);
+	static uint64_t bucket_high(size_t index);
+
+private:
+	std::atomic<uint64_t> buckets[histogram_buckets];
+	std::atomic<uint64_t> total;
+	std::atomic<uint64_t> sum;
+	std::atomic<uint64_t> _min;
+	std::atomic<uint64_t> _max;
+};
+
+};
@@ -3,9 +3,12 @@
 #include "Program.h"
 #include "LLVMUtils.h"
 #include <sstream>
+#include <algorithm>
+#include <cmath>
 #include "Namespace.h"
 #include "Diagnostics.h"
 #include "llvm/IR/Constants.h"
+#include "TraceLog.h"
 
 namespace xerxzema
 {
@@ -137,6 +140,31 @@ bool Instruction::is_ugen()
 	return false;
 }
 
+bool Instruction::has_side_effects()
+{
+	return false;
+}
+
+bool Instruction::has_deferred_outputs()
+{
+	return false;
+}
+
+bool Instruction::is_constant()
+{
+	return false;
+}
+
+std::unique_ptr<Instruction> Instruction::fold(const std::vector<Instruction*>& inputs)
+{
+	return nullptr;
+}
+
+bool Instruction::is_fusable()
+{
+	return false;
+}
+
 llvm::Type* Instruction::state_type(llvm::LLVMContext& context)
 {
 	return nullptr;
@@ -205,6 +233,17 @@ void Instruction::generate_state_destructor(llvm::LLVMContext &context,
 {
 }
 
+void Instruction::transfer_input(llvm::LLVMContext &context, llvm::IRBuilder<> &builder,
+								 xerxzema::Program *program, size_t input, llvm::Value* dst_ptr)
+{
+	auto reg = _inputs[input];
+	auto src_ptr = reg->fetch_value_raw(context, builder);
+	if(program->is_last_use(reg, this))
+		reg->type()->move(context, builder, program, dst_ptr, src_ptr);
+	else
+		reg->type()->copy(context, builder, program, dst_ptr, src_ptr);
+}
+
 
 void Merge::generate_check(llvm::LLVMContext& context,
 								 llvm::IRBuilder<> &builder,
@@ -249,9 +288,7 @@ void Merge::generate_prolouge(llvm::LLVMContext &context,
 	builder.CreateCondBr(comp_value, arg0_block, arg1_block);
 
 	builder.SetInsertPoint(arg0_block);
-	_inputs[0]->type()->copy(context, builder, program,
-							 _outputs[0]->fetch_value_raw(context, builder),
-							 _inputs[0]->fetch_value_raw(context, builder));
+	transfer_input(context, builder, program, 0, _outputs[0]->fetch_value_raw(context, builder));
 
 	for(auto& r:_outputs)
 	{
@@ -260,9 +297,7 @@ void Merge::generate_prolouge(llvm::LLVMContext &context,
 	builder.CreateBr(next_block);
 
 	builder.SetInsertPoint(arg1_block);
-	_inputs[1]->type()->copy(context, builder, program,
-							 _outputs[0]->fetch_value_raw(context, builder),
-							 _inputs[1]->fetch_value_raw(context, builder));
+	transfer_input(context, builder, program, 1, _outputs[0]->fetch_value_raw(context, builder));
 
 	for(auto& r:_outputs)
 	{
@@ -377,14 +412,64 @@ void ValueInt::generate_operation(llvm::LLVMContext &context, llvm::IRBuilder<>
 }
 
 
+//points reg at a constant global without copying it. alloc stays 0 so the array
+//runtime never frees it and the first write into the register makes a private copy.
+static void generate_borrowed_array(llvm::LLVMContext &context, llvm::IRBuilder<> &builder,
+									Program* program, Register* reg,
+									llvm::Value* global, int64_t size)
+{
+	auto release = program->name_space()->get_external_function("array_release",
+																program->current_module(),
+																context);
+	auto array_type = reg->type()->type(context);
+	auto array_struct = reg->fetch_value_raw(context, builder);
+	builder.CreateCall(release, {builder.CreatePointerCast(array_struct,
+														   llvm::Type::getInt8PtrTy(context))});
+
+	auto data = builder.CreateInBoundsGEP(global, {builder.getInt32(0), builder.getInt32(0)});
+	builder.CreateStore(data, builder.CreateStructGEP(array_type, array_struct, 0));
+	builder.CreateStore(builder.getInt64(size), builder.CreateStructGEP(array_type, array_struct, 1));
+	builder.CreateStore(builder.getInt64(0), builder.CreateStructGEP(array_type, array_struct, 2));
+}
+
 ValueString::ValueString(const std::string& v):value(v) {}
+//the terminating 0 isn't counted in the size but it's there so the data can
+//go straight to printf
 void ValueString::generate_operation(llvm::LLVMContext &context, llvm::IRBuilder<> &builder,
 									 xerxzema::Program *program)
 {
 	auto string_value = builder.CreateGlobalString(value);
-	ArrayBuilder array_builder = ArrayBuilder(program->name_space()->type("byte"), string_value);
-	array_builder.output(_outputs[0]);
-	array_builder.generate_operation(context, builder, program);
+	generate_borrowed_array(context, builder, program, _outputs[0], string_value, value.size());
+}
+
+ValueArray::ValueArray(const std::vector<double>& v) : values(v)
+{
+}
+
+std::string ValueArray::constant_description()
+{
+	//exact, this is what the optimizer merges literals on
+	std::string description;
+	char buffer[32];
+	for(auto& v: values)
+	{
+		if(!description.empty())
+			description += ' ';
+		snprintf(buffer, sizeof(buffer), "%.17g", v);
+		description += buffer;
+	}
+	return description;
+}
+
+void ValueArray::generate_operation(llvm::LLVMContext &context, llvm::IRBuilder<> &builder,
+									xerxzema::Program *program)
+{
+	auto initializer = llvm::ConstantDataArray::get(context, llvm::ArrayRef<double>(values));
+	auto global = new llvm::GlobalVariable(*program->current_module(), initializer->getType(),
+										   true, llvm::GlobalValue::PrivateLinkage, initializer,
+										   "const_array");
+	global->setUnnamedAddr(llvm::GlobalValue::UnnamedAddr::Global);
+	generate_borrowed_array(context, builder, program, _outputs[0], global, values.size());
 }
 
 ProgramDirectCall::ProgramDirectCall(Program* target) : target(target) {}
@@ -397,25 +482,30 @@ llvm::Type* ProgramDirectCall::state_type(llvm::LLVMContext &context)
 	return _state_type;
 }
 
-void ProgramDirectCall::generate_operation(llvm::LLVMContext &context, llvm::IRBuilder<> &builder,
-										   xerxzema::Program *program)
+llvm::Function* ProgramDirectCall::target_function(llvm::LLVMContext &context,
+												  xerxzema::Program *program)
 {
 	auto fn = program->current_module()->getFunction(target->symbol_name());
 	if(!fn)
 	{
 		fn = program->create_declaration(program->current_module(), context);
 	}
+	return fn;
+}
+
+void ProgramDirectCall::generate_operation(llvm::LLVMContext &context, llvm::IRBuilder<> &builder,
+										   xerxzema::Program *program)
+{
+	auto fn = target_function(context, program);
 
 	//state_value locally is an alloca so that makes it a pointer to a pointer.
 	auto state = builder.CreateLoad(state_value());
-	auto in_counter = 0;
-	for(auto& reg:_inputs)
+	//big arrays get handed over or shared, never copied
+	for(size_t in_counter = 0; in_counter < _inputs.size(); in_counter++)
 	{
 		auto program_offset = target->input_registers()[in_counter]->offset();
 		auto value_ptr = builder.CreateStructGEP(target->state_type_value(), state, program_offset);
-		reg->type()->copy(context, builder, program,
-						  value_ptr, reg->fetch_value_raw(context, builder));
-		in_counter++;
+		transfer_input(context, builder, program, in_counter, value_ptr);
 	}
 	auto call_ret = builder.CreateCall(fn, {state});
 	//TODO once we hook up return states from functions
@@ -470,53 +560,172 @@ void ProgramDirectCall::generate_state_destructor(llvm::LLVMContext &context,
 	builder.CreateCall(fn, {cast});
 }
 
-void AddReal::generate_operation(llvm::LLVMContext &context, llvm::IRBuilder<> &builder,
-								 xerxzema::Program *program)
+void RealArithmetic::generate_operation(llvm::LLVMContext &context, llvm::IRBuilder<> &builder,
+										xerxzema::Program *program)
 {
 	auto lhs = _inputs[0]->fetch_value(context, builder);
 	auto rhs = _inputs[1]->fetch_value(context, builder);
-	auto p = builder.CreateFAdd(lhs, rhs);
+	auto p = generate_value(context, builder, program, lhs, rhs);
 	builder.CreateStore(p, _outputs[0]->fetch_value_raw(context, builder));
 }
 
-void SubReal::generate_operation(llvm::LLVMContext &context, llvm::IRBuilder<> &builder,
-								 xerxzema::Program *program)
+std::unique_ptr<Instruction> RealArithmetic::fold(const std::vector<Instruction*>& inputs)
 {
-	auto lhs = _inputs[0]->fetch_value(context, builder);
-	auto rhs = _inputs[1]->fetch_value(context, builder);
-	auto p = builder.CreateFSub(lhs, rhs);
-	builder.CreateStore(p, _outputs[0]->fetch_value_raw(context, builder));
+	if(inputs.size() != 2)
+		return nullptr;
+	for(auto& i: inputs)
+	{
+		if(!i->is_constant() || i->name() != "value_real")
+			return nullptr;
+	}
+	auto lhs = static_cast<ValueReal*>(inputs[0])->constant();
+	auto rhs = static_cast<ValueReal*>(inputs[1])->constant();
+	return std::make_unique<ValueReal>(evaluate(lhs, rhs));
 }
 
-void MulReal::generate_operation(llvm::LLVMContext &context, llvm::IRBuilder<> &builder,
-								 xerxzema::Program *program)
+llvm::Value* AddReal::generate_value(llvm::LLVMContext &context, llvm::IRBuilder<> &builder,
+									 xerxzema::Program *program, llvm::Value* lhs, llvm::Value* rhs)
 {
-	auto lhs = _inputs[0]->fetch_value(context, builder);
-	auto rhs = _inputs[1]->fetch_value(context, builder);
-	auto p = builder.CreateFMul(lhs, rhs);
-	builder.CreateStore(p, _outputs[0]->fetch_value_raw(context, builder));
+	return builder.CreateFAdd(lhs, rhs);
 }
 
-void DivReal::generate_operation(llvm::LLVMContext &context, llvm::IRBuilder<> &builder,
-								 xerxzema::Program *program)
+double AddReal::evaluate(double lhs, double rhs)
+{
+	return lhs + rhs;
+}
+
+llvm::Value* SubReal::generate_value(llvm::LLVMContext &context, llvm::IRBuilder<> &builder,
+									 xerxzema::Program *program, llvm::Value* lhs, llvm::Value* rhs)
+{
+	return builder.CreateFSub(lhs, rhs);
+}
+
+double SubReal::evaluate(double lhs, double rhs)
+{
+	return lhs - rhs;
+}
+
+llvm::Value* MulReal::generate_value(llvm::LLVMContext &context, llvm::IRBuilder<> &builder,
+									 xerxzema::Program *program, llvm::Value* lhs, llvm::Value* rhs)
+{
+	return builder.CreateFMul(lhs, rhs);
+}
+
+double MulReal::evaluate(double lhs, double rhs)
+{
+	return lhs * rhs;
+}
+
+llvm::Value* DivReal::generate_value(llvm::LLVMContext &context, llvm::IRBuilder<> &builder,
+									 xerxzema::Program *program, llvm::Value* lhs, llvm::Value* rhs)
+{
+	return builder.CreateFDiv(lhs, rhs);
+}
+
+double DivReal::evaluate(double lhs, double rhs)
+{
+	return lhs / rhs;
+}
+
+llvm::Value* PowReal::generate_value(llvm::LLVMContext &context, llvm::IRBuilder<> &builder,
+									 xerxzema::Program *program, llvm::Value* lhs, llvm::Value* rhs)
+{
+	auto call = llvm::Intrinsic::getDeclaration(program->current_module(), llvm::Intrinsic::pow,
+												{lhs->getType()});
+	return builder.CreateCall(call, {lhs, rhs});
+}
+
+double PowReal::evaluate(double lhs, double rhs)
+{
+	return std::pow(lhs, rhs);
+}
+
+PowiReal::PowiReal(int32_t e) : exponent(e)
+{
+}
+
+void PowiReal::generate_operation(llvm::LLVMContext &context, llvm::IRBuilder<> &builder,
+								  xerxzema::Program *program)
 {
 	auto lhs = _inputs[0]->fetch_value(context, builder);
-	auto rhs = _inputs[1]->fetch_value(context, builder);
-	auto p = builder.CreateFDiv(lhs, rhs);
+	auto call = llvm::Intrinsic::getDeclaration(program->current_module(), llvm::Intrinsic::powi,
+												{lhs->getType()});
+	auto p = builder.CreateCall(call, {lhs, builder.getInt32(exponent)});
 	builder.CreateStore(p, _outputs[0]->fetch_value_raw(context, builder));
 }
 
-void PowReal::generate_operation(llvm::LLVMContext &context, llvm::IRBuilder<> &builder,
-								 xerxzema::Program *program)
+FusedReal::FusedReal()
 {
-	auto lhs = _inputs[0]->fetch_value(context, builder);
-	auto rhs = _inputs[1]->fetch_value(context, builder);
-	auto call = llvm::Intrinsic::getDeclaration(program->current_module(), llvm::Intrinsic::pow,
-												{llvm::Type::getDoubleTy(context)});
-	auto p = builder.CreateCall(call, {rhs, lhs});
+}
+
+static bool is_mul_node(FusedNode* node)
+{
+	return node->op && node->op->name() == "mul";
+}
+
+llvm::Value* FusedReal::generate_node(llvm::LLVMContext &context, llvm::IRBuilder<> &builder,
+									  xerxzema::Program *program, FusedNode* node)
+{
+	if(!node->op)
+		return _inputs[node->input]->fetch_value(context, builder);
+
+	//strict mode keeps the separate rounding steps of a*b+c
+	auto name = node->op->name();
+	if((name == "add" || name == "sub") &&
+	   program->name_space()->float_mode() != FloatMode::Strict)
+	{
+		FusedNode* product = nullptr;
+		FusedNode* addend = nullptr;
+		if(is_mul_node(node->lhs.get()))
+		{
+			product = node->lhs.get();
+			addend = node->rhs.get();
+		}
+		else if(name == "add" && is_mul_node(node->rhs.get()))
+		{
+			product = node->rhs.get();
+			addend = node->lhs.get();
+		}
+
+		if(product)
+		{
+			auto a = generate_node(context, builder, program, product->lhs.get());
+			auto b = generate_node(context, builder, program, product->rhs.get());
+			auto c = generate_node(context, builder, program, addend);
+			if(name == "sub")
+				c = builder.CreateFNeg(c);
+			auto fma = llvm::Intrinsic::getDeclaration(program->current_module(),
+													   llvm::Intrinsic::fmuladd,
+													   {a->getType()});
+			return builder.CreateCall(fma, {a, b, c});
+		}
+	}
+
+	auto lhs = generate_node(context, builder, program, node->lhs.get());
+	auto rhs = generate_node(context, builder, program, node->rhs.get());
+	return node->op->generate_value(context, builder, program, lhs, rhs);
+}
+
+void FusedReal::generate_operation(llvm::LLVMContext &context, llvm::IRBuilder<> &builder,
+								   xerxzema::Program *program)
+{
+	auto p = generate_node(context, builder, program, root.get());
 	builder.CreateStore(p, _outputs[0]->fetch_value_raw(context, builder));
 }
 
+std::string FusedReal::describe_node(FusedNode* node)
+{
+	if(!node->op)
+		return "$" + std::to_string(node->input);
+	return "(" + node->op->name() + " " + describe_node(node->lhs.get()) + " " +
+		describe_node(node->rhs.get()) + ")";
+}
+
+std::string FusedReal::constant_description()
+{
+	return describe_node(root.get());
+}
+
 void EqReal::generate_operation(llvm::LLVMContext &context, llvm::IRBuilder<> &builder,
 								 xerxzema::Program *program)
 {
@@ -571,6 +780,292 @@ void GeReal::generate_operation(llvm::LLVMContext &context, llvm::IRBuilder<> &b
 	builder.CreateStore(p, _outputs[0]->fetch_value_raw(context, builder));
 }
 
+void ConvertReal::generate_operation(llvm::LLVMContext &context, llvm::IRBuilder<> &builder,
+									 xerxzema::Program *program)
+{
+	auto v = _inputs[0]->fetch_value(context, builder);
+	auto p = builder.CreateFPCast(v, _outputs[0]->type()->type(context));
+	builder.CreateStore(p, _outputs[0]->fetch_value_raw(context, builder));
+}
+
+void VectorBuild::generate_operation(llvm::LLVMContext &context, llvm::IRBuilder<> &builder,
+									 xerxzema::Program *program)
+{
+	auto width = vector_width(_outputs[0]->type());
+	llvm::Value* v = nullptr;
+	if(_inputs.size() == 1)
+	{
+		v = builder.CreateVectorSplat(width, _inputs[0]->fetch_value(context, builder));
+	}
+	else
+	{
+		v = llvm::UndefValue::get(_outputs[0]->type()->type(context));
+		for(uint32_t i = 0; i < width; i++)
+		{
+			v = builder.CreateInsertElement(v, _inputs[i]->fetch_value(context, builder),
+											builder.getInt32(i));
+		}
+	}
+	builder.CreateStore(v, _outputs[0]->fetch_value_raw(context, builder));
+}
+
+void VectorExtract::generate_operation(llvm::LLVMContext &context, llvm::IRBuilder<> &builder,
+									   xerxzema::Program *program)
+{
+	auto v = _inputs[0]->fetch_value(context, builder);
+	auto index = _inputs[1]->fetch_value(context, builder);
+	if(index->getType()->isFloatingPointTy())
+		index = builder.CreateFPToSI(index, builder.getInt64Ty());
+	//the widths are powers of two
+	auto width = vector_width(_inputs[0]->type());
+	index = builder.CreateAnd(index, builder.getInt64(width - 1));
+	auto p = builder.CreateExtractElement(v, index);
+	builder.CreateStore(p, _outputs[0]->fetch_value_raw(context, builder));
+}
+
+VectorShuffle::VectorShuffle(const std::vector<uint32_t>& m) : mask(m)
+{
+}
+
+void VectorShuffle::generate_operation(llvm::LLVMContext &context, llvm::IRBuilder<> &builder,
+									   xerxzema::Program *program)
+{
+	auto v = _inputs[0]->fetch_value(context, builder);
+	auto lanes = llvm::ConstantDataVector::get(context, mask);
+	auto p = builder.CreateShuffleVector(v, llvm::UndefValue::get(v->getType()), lanes);
+	builder.CreateStore(p, _outputs[0]->fetch_value_raw(context, builder));
+}
+
+std::string VectorShuffle::constant_description()
+{
+	std::string desc;
+	for(auto lane: mask)
+	{
+		if(desc.size())
+			desc += " ";
+		desc += std::to_string(lane);
+	}
+	return desc;
+}
+
+void IntArithmetic::generate_operation(llvm::LLVMContext &context, llvm::IRBuilder<> &builder,
+									   xerxzema::Program *program)
+{
+	auto lhs = _inputs[0]->fetch_value(context, builder);
+	auto rhs = _inputs[1]->fetch_value(context, builder);
+	auto p = generate_value(context, builder, program, lhs, rhs);
+	builder.CreateStore(p, _outputs[0]->fetch_value_raw(context, builder));
+}
+
+std::unique_ptr<Instruction> IntArithmetic::fold(const std::vector<Instruction*>& inputs)
+{
+	if(inputs.size() != 2)
+		return nullptr;
+	for(auto& i: inputs)
+	{
+		if(!i->is_constant() || i->name() != "value_int")
+			return nullptr;
+	}
+	auto lhs = static_cast<ValueInt*>(inputs[0])->constant();
+	auto rhs = static_cast<ValueInt*>(inputs[1])->constant();
+	return std::make_unique<ValueInt>(evaluate(lhs, rhs));
+}
+
+//signed overflow is undefined in c++ so the host side does the math unsigned,
+//which wraps the same way the generated code does.
+llvm::Value* AddInt::generate_value(llvm::LLVMContext &context, llvm::IRBuilder<> &builder,
+									xerxzema::Program *program, llvm::Value* lhs, llvm::Value* rhs)
+{
+	return builder.CreateAdd(lhs, rhs);
+}
+
+int64_t AddInt::evaluate(int64_t lhs, int64_t rhs)
+{
+	return (int64_t)((uint64_t)lhs + (uint64_t)rhs);
+}
+
+llvm::Value* SubInt::generate_value(llvm::LLVMContext &context, llvm::IRBuilder<> &builder,
+									xerxzema::Program *program, llvm::Value* lhs, llvm::Value* rhs)
+{
+	return builder.CreateSub(lhs, rhs);
+}
+
+int64_t SubInt::evaluate(int64_t lhs, int64_t rhs)
+{
+	return (int64_t)((uint64_t)lhs - (uint64_t)rhs);
+}
+
+llvm::Value* MulInt::generate_value(llvm::LLVMContext &context, llvm::IRBuilder<> &builder,
+									xerxzema::Program *program, llvm::Value* lhs, llvm::Value* rhs)
+{
+	return builder.CreateMul(lhs, rhs);
+}
+
+int64_t MulInt::evaluate(int64_t lhs, int64_t rhs)
+{
+	return (int64_t)((uint64_t)lhs * (uint64_t)rhs);
+}
+
+//sdiv traps on x / 0 and on INT64_MIN / -1. the divisor is swapped for 1 in both
+//cases and the real answer (0 and -x) is selected afterwards so the hot path
+//is still a single idiv.
+static llvm::Value* safe_divisor(llvm::IRBuilder<> &builder, llvm::Value* rhs,
+								 llvm::Value*& is_zero, llvm::Value*& is_negative_one)
+{
+	is_zero = builder.CreateICmpEQ(rhs, builder.getInt64(0));
+	is_negative_one = builder.CreateICmpEQ(rhs, builder.getInt64(-1));
+	return builder.CreateSelect(builder.CreateOr(is_zero, is_negative_one),
+								builder.getInt64(1), rhs);
+}
+
+llvm::Value* DivInt::generate_value(llvm::LLVMContext &context, llvm::IRBuilder<> &builder,
+									xerxzema::Program *program, llvm::Value* lhs, llvm::Value* rhs)
+{
+	llvm::Value* is_zero;
+	llvm::Value* is_negative_one;
+	auto divisor = safe_divisor(builder, rhs, is_zero, is_negative_one);
+	auto quotient = builder.CreateSDiv(lhs, divisor);
+	auto negated = builder.CreateSub(builder.getInt64(0), lhs);
+	return builder.CreateSelect(is_zero, builder.getInt64(0),
+								builder.CreateSelect(is_negative_one, negated, quotient));
+}
+
+int64_t DivInt::evaluate(int64_t lhs, int64_t rhs)
+{
+	if(rhs == 0)
+		return 0;
+	if(rhs == -1)
+		return (int64_t)(0 - (uint64_t)lhs);
+	return lhs / rhs;
+}
+
+llvm::Value* ModInt::generate_value(llvm::LLVMContext &context, llvm::IRBuilder<> &builder,
+									xerxzema::Program *program, llvm::Value* lhs, llvm::Value* rhs)
+{
+	llvm::Value* is_zero;
+	llvm::Value* is_negative_one;
+	auto divisor = safe_divisor(builder, rhs, is_zero, is_negative_one);
+	//x % 1 is already 0 so the swapped divisor gives the right answer for both cases
+	return builder.CreateSRem(lhs, divisor);
+}
+
+int64_t ModInt::evaluate(int64_t lhs, int64_t rhs)
+{
+	if(rhs == 0 || rhs == -1)
+		return 0;
+	return lhs % rhs;
+}
+
+llvm::Value* AndInt::generate_value(llvm::LLVMContext &context, llvm::IRBuilder<> &builder,
+									xerxzema::Program *program, llvm::Value* lhs, llvm::Value* rhs)
+{
+	return builder.CreateAnd(lhs, rhs);
+}
+
+int64_t AndInt::evaluate(int64_t lhs, int64_t rhs)
+{
+	return lhs & rhs;
+}
+
+llvm::Value* OrInt::generate_value(llvm::LLVMContext &context, llvm::IRBuilder<> &builder,
+								   xerxzema::Program *program, llvm::Value* lhs, llvm::Value* rhs)
+{
+	return builder.CreateOr(lhs, rhs);
+}
+
+int64_t OrInt::evaluate(int64_t lhs, int64_t rhs)
+{
+	return lhs | rhs;
+}
+
+llvm::Value* XorInt::generate_value(llvm::LLVMContext &context, llvm::IRBuilder<> &builder,
+									xerxzema::Program *program, llvm::Value* lhs, llvm::Value* rhs)
+{
+	return builder.CreateXor(lhs, rhs);
+}
+
+int64_t XorInt::evaluate(int64_t lhs, int64_t rhs)
+{
+	return lhs ^ rhs;
+}
+
+//shifting by >= the bit width is poison in llvm, mask it the way x86 does
+llvm::Value* ShlInt::generate_value(llvm::LLVMContext &context, llvm::IRBuilder<> &builder,
+									xerxzema::Program *program, llvm::Value* lhs, llvm::Value* rhs)
+{
+	return builder.CreateShl(lhs, builder.CreateAnd(rhs, builder.getInt64(63)));
+}
+
+int64_t ShlInt::evaluate(int64_t lhs, int64_t rhs)
+{
+	return (int64_t)((uint64_t)lhs << (rhs & 63));
+}
+
+llvm::Value* ShrInt::generate_value(llvm::LLVMContext &context, llvm::IRBuilder<> &builder,
+									xerxzema::Program *program, llvm::Value* lhs, llvm::Value* rhs)
+{
+	return builder.CreateAShr(lhs, builder.CreateAnd(rhs, builder.getInt64(63)));
+}
+
+int64_t ShrInt::evaluate(int64_t lhs, int64_t rhs)
+{
+	return lhs >> (rhs & 63);
+}
+
+void EqInt::generate_operation(llvm::LLVMContext &context, llvm::IRBuilder<> &builder,
+								xerxzema::Program *program)
+{
+	auto lhs = _inputs[0]->fetch_value(context, builder);
+	auto rhs = _inputs[1]->fetch_value(context, builder);
+	auto p = builder.CreateICmpEQ(lhs, rhs);
+	builder.CreateStore(p, _outputs[0]->fetch_value_raw(context, builder));
+}
+
+void NeInt::generate_operation(llvm::LLVMContext &context, llvm::IRBuilder<> &builder,
+								xerxzema::Program *program)
+{
+	auto lhs = _inputs[0]->fetch_value(context, builder);
+	auto rhs = _inputs[1]->fetch_value(context, builder);
+	auto p = builder.CreateICmpNE(lhs, rhs);
+	builder.CreateStore(p, _outputs[0]->fetch_value_raw(context, builder));
+}
+
+void LtInt::generate_operation(llvm::LLVMContext &context, llvm::IRBuilder<> &builder,
+								xerxzema::Program *program)
+{
+	auto lhs = _inputs[0]->fetch_value(context, builder);
+	auto rhs = _inputs[1]->fetch_value(context, builder);
+	auto p = builder.CreateICmpSLT(lhs, rhs);
+	builder.CreateStore(p, _outputs[0]->fetch_value_raw(context, builder));
+}
+
+void LeInt::generate_operation(llvm::LLVMContext &context, llvm::IRBuilder<> &builder,
+								xerxzema::Program *program)
+{
+	auto lhs = _inputs[0]->fetch_value(context, builder);
+	auto rhs = _inputs[1]->fetch_value(context, builder);
+	auto p = builder.CreateICmpSLE(lhs, rhs);
+	builder.CreateStore(p, _outputs[0]->fetch_value_raw(context, builder));
+}
+
+void GtInt::generate_operation(llvm::LLVMContext &context, llvm::IRBuilder<> &builder,
+								xerxzema::Program *program)
+{
+	auto lhs = _inputs[0]->fetch_value(context, builder);
+	auto rhs = _inputs[1]->fetch_value(context, builder);
+	auto p = builder.CreateICmpSGT(lhs, rhs);
+	builder.CreateStore(p, _outputs[0]->fetch_value_raw(context, builder));
+}
+
+void GeInt::generate_operation(llvm::LLVMContext &context, llvm::IRBuilder<> &builder,
+								xerxzema::Program *program)
+{
+	auto lhs = _inputs[0]->fetch_value(context, builder);
+	auto rhs = _inputs[1]->fetch_value(context, builder);
+	auto p = builder.CreateICmpSGE(lhs, rhs);
+	builder.CreateStore(p, _outputs[0]->fetch_value_raw(context, builder));
+}
+
 llvm::Type* Delay::state_type(llvm::LLVMContext &context)
 {
 
@@ -585,12 +1080,167 @@ llvm::Type* Delay::state_type(llvm::LLVMContext &context)
 	return _state_type;
 }
 
+//longest delay in samples, anything past this is clamped. with the slots the
+//ring keeps past the oldest tap it still fits in 1 << 27 reals (1 GiB).
+static const int64_t delay_line_max = (1 << 27) - 3;
+
+DelayLine::DelayLine(bool i) : interpolated(i), reserved_tap(-1)
+{
+}
+
+void DelayLine::reserve(double tap)
+{
+	if(tap != tap)
+		tap = 0;
+	reserved_tap = (int64_t)std::ceil(std::min(std::max(tap, 0.0), (double)delay_line_max));
+}
+
+//mirrors the DelayLine struct in RT.cpp
+llvm::Type* DelayLine::state_type(llvm::LLVMContext &context)
+{
+	if(_state_type)
+		return _state_type;
+
+	std::vector<llvm::Type*> data_types;
+	data_types.push_back(llvm::Type::getDoublePtrTy(context)); //ring
+	data_types.push_back(llvm::Type::getInt64Ty(context)); //capacity - 1
+	data_types.push_back(llvm::Type::getInt64Ty(context)); //write position
+
+	_state_type = llvm::StructType::create(context, data_types);
+	return _state_type;
+}
+
+void DelayLine::generate_operation(llvm::LLVMContext &context, llvm::IRBuilder<> &builder,
+								   Program *program)
+{
+	auto function = program->function_value();
+	auto index_type = llvm::Type::getInt64Ty(context);
+	auto x = _inputs[0]->fetch_value(context, builder);
+	auto n = _inputs[1]->fetch_value(context, builder);
+
+	//negative delays read the current sample, nan ends up at 0 too
+	llvm::Value* tap = nullptr;
+	llvm::Value* fraction = nullptr;
+	if(interpolated)
+	{
+		auto zero = llvm::ConstantFP::get(n->getType(), 0.0);
+		auto max = llvm::ConstantFP::get(n->getType(), (double)delay_line_max);
+		n = builder.CreateSelect(builder.CreateFCmpOGT(n, zero), n, zero);
+		n = builder.CreateSelect(builder.CreateFCmpOLT(n, max), n, max);
+		tap = builder.CreateFPToSI(n, index_type);
+		fraction = builder.CreateFSub(n, builder.CreateSIToFP(tap, n->getType()));
+	}
+	else
+	{
+		auto max = builder.getInt64(delay_line_max);
+		tap = builder.CreateSelect(builder.CreateICmpSGT(n, builder.getInt64(0)),
+								   n, builder.getInt64(0));
+		tap = builder.CreateSelect(builder.CreateICmpSLT(tap, max), tap, max);
+	}
+
+	//the ring keeps at least one slot beyond the oldest tap so a zeroed state
+	//(mask 0) always grows on first use
+	auto extra = builder.getInt64(interpolated ? 2 : 1);
+	auto needed = builder.CreateAdd(tap, extra);
+	auto data_ptr = builder.CreateStructGEP(_state_type, _state_value, 0);
+	auto mask_ptr = builder.CreateStructGEP(_state_type, _state_value, 1);
+	auto entry_block = builder.GetInsertBlock();
+	auto grow_block = llvm::BasicBlock::Create(context, "delay_grow", function);
+	auto clamp_block = llvm::BasicBlock::Create(context, "delay_clamp", function);
+	auto missing_block = llvm::BasicBlock::Create(context, "delay_missing", function);
+	auto ready_block = llvm::BasicBlock::Create(context, "delay_ready", function);
+	auto done_block = llvm::BasicBlock::Create(context, "delay_done", function);
+	builder.CreateCondBr(builder.CreateICmpSGT(needed, builder.CreateLoad(mask_ptr)),
+						 grow_block, ready_block);
+
+	builder.SetInsertPoint(grow_block);
+	auto grow = program->name_space()->get_external_function("delay_grow",
+															 program->current_module(), context);
+	builder.CreateCall(grow, {builder.CreatePointerCast(_state_value,
+														llvm::Type::getInt8PtrTy(context)),
+				needed});
+	//the ring stays as it was when the allocation failed, there might not be one yet
+	auto grown_data = builder.CreateLoad(data_ptr);
+	builder.CreateCondBr(builder.CreateIsNull(grown_data), missing_block, clamp_block);
+
+	builder.SetInsertPoint(clamp_block);
+	auto limit = builder.CreateSub(builder.CreateLoad(mask_ptr), extra);
+	auto clamped = builder.CreateSelect(builder.CreateICmpSLT(tap, limit), tap, limit);
+	builder.CreateBr(ready_block);
+
+	builder.SetInsertPoint(missing_block);
+	builder.CreateStore(llvm::ConstantFP::get(x->getType(), 0.0),
+						_outputs[0]->fetch_value_raw(context, builder));
+	builder.CreateBr(done_block);
+
+	builder.SetInsertPoint(ready_block);
+	auto tap_phi = builder.CreatePHI(index_type, 2);
+	tap_phi->addIncoming(tap, entry_block);
+	tap_phi->addIncoming(clamped, clamp_block);
+	tap = tap_phi;
+	auto data = builder.CreateLoad(data_ptr);
+	auto mask = builder.CreateLoad(mask_ptr);
+	auto position_ptr = builder.CreateStructGEP(_state_type, _state_value, 2);
+	auto position = builder.CreateLoad(position_ptr);
+
+	builder.CreateStore(x, builder.CreateGEP(data, builder.CreateAnd(position, mask)));
+	auto newer_index = builder.CreateAnd(builder.CreateSub(position, tap), mask);
+	llvm::Value* result = builder.CreateLoad(builder.CreateGEP(data, newer_index));
+	if(interpolated)
+	{
+		auto older_index = builder.CreateAnd(builder.CreateSub(newer_index, builder.getInt64(1)),
+											 mask);
+		auto older = builder.CreateLoad(builder.CreateGEP(data, older_index));
+		result = builder.CreateFAdd(result,
+									builder.CreateFMul(builder.CreateFSub(older, result), fraction));
+	}
+	builder.CreateStore(result, _outputs[0]->fetch_value_raw(context, builder));
+	builder.CreateStore(builder.CreateAdd(position, builder.getInt64(1)), position_ptr);
+	builder.CreateBr(done_block);
+
+	builder.SetInsertPoint(done_block);
+}
+
+void DelayLine::generate_state_initializer(llvm::LLVMContext &context,
+										   llvm::IRBuilder<> &builder,
+										   xerxzema::Program *program)
+{
+	Instruction::generate_state_initializer(context, builder, program);
+	if(reserved_tap < 0)
+		return;
+	auto grow = program->name_space()->get_external_function("delay_grow",
+															 program->current_module(), context);
+	builder.CreateCall(grow, {builder.CreatePointerCast(_state_value,
+														llvm::Type::getInt8PtrTy(context)),
+				builder.getInt64(reserved_tap + (interpolated ? 2 : 1))});
+}
+
+void DelayLine::generate_state_destructor(llvm::LLVMContext &context,
+										  llvm::IRBuilder<> &builder,
+										  xerxzema::Program *program,
+										  llvm::Value* state_ptr)
+{
+	auto data = builder.CreateLoad(builder.CreateStructGEP(_state_type, state_ptr, 0));
+	auto fn = program->name_space()->get_external_function("free", program->current_module(), context);
+	builder.CreateCall(fn, {builder.CreateBitCast(data, llvm::Type::getInt8PtrTy(context))});
+}
+
 void Delay::generate_operation(llvm::LLVMContext &context, llvm::IRBuilder<> &builder,
 							   Program *program)
 {
 
 }
 
+//the held value is owned by the state
+void Delay::generate_state_destructor(llvm::LLVMContext &context,
+									  llvm::IRBuilder<> &builder,
+									  xerxzema::Program *program,
+									  llvm::Value* state_ptr)
+{
+	auto held = builder.CreateStructGEP(_state_type, state_ptr, 1);
+	_inputs[0]->type()->destroy(context, builder, program, held);
+}
+
 void Delay::generate_prolouge(llvm::LLVMContext &context, llvm::IRBuilder<> &builder,
 							  Program *program, llvm::BasicBlock *next_block)
 {
@@ -617,7 +1267,7 @@ void Delay::generate_prolouge(llvm::LLVMContext &context, llvm::IRBuilder<> &bui
 	delay_val_ptr = builder.CreateStructGEP(_state_type, _state_value, 1);
 	auto in_ptr = _inputs[0]->fetch_value_raw(context, builder);
 	auto out_ptr = _outputs[0]->fetch_value_raw(context, builder);
-	_inputs[0]->type()->copy(context, builder, program, out_ptr, delay_val_ptr);
+	_inputs[0]->type()->move(context, builder, program, out_ptr, delay_val_ptr);
 	_inputs[0]->type()->copy(context, builder, program, delay_val_ptr, in_ptr);
 
 	auto p = builder.CreateLoad(program->activation_counter_value());
@@ -651,9 +1301,7 @@ void When::generate_prolouge(llvm::LLVMContext &context, llvm::IRBuilder<> &buil
 	builder.CreateCondBr(test_val, true_block, false_block);
 
 	builder.SetInsertPoint(true_block);
-	_inputs[1]->type()->copy(context, builder, program,
-							 _outputs[0]->fetch_value_raw(context, builder),
-							 _inputs[1]->fetch_value_raw(context, builder));
+	transfer_input(context, builder, program, 1, _outputs[0]->fetch_value_raw(context, builder));
 
 	for(auto& r:_outputs)
 	{
@@ -714,44 +1362,38 @@ void Bang::generate_operation(llvm::LLVMContext &context, llvm::IRBuilder<> &bui
 
 }
 
+//loads the data pointer and element count out of an array register
+static std::pair<llvm::Value*, llvm::Value*> generate_array_fetch(llvm::LLVMContext &context,
+																  llvm::IRBuilder<> &builder,
+																  Register* reg)
+{
+	auto array_type = reg->type()->type(context);
+	auto array_struct = reg->fetch_value_raw(context, builder);
+	auto data = builder.CreateLoad(builder.CreateStructGEP(array_type, array_struct, 0));
+	auto size = builder.CreateLoad(builder.CreateStructGEP(array_type, array_struct, 1));
+	return {data, size};
+}
+
+//writes a binary record into this thread's trace buffer, the text is formatted
+//later on the trace log's own thread. see TraceLog
 void Trace::generate_operation(llvm::LLVMContext &context, llvm::IRBuilder<> &builder,
 							  Program *program)
 {
-	llvm::Value* format_str;
-
-	if(_inputs[0]->type()->name() == "real")
-	{
-		std::string input_str("(");
-		input_str += _inputs[0]->name();
-		input_str += ") %f\n";
-		format_str = builder.CreateGlobalString(input_str);
-	}
-	else if(_inputs[0]->type() == program->name_space()->type("string"))
-	{
-		std::string input_str("(");
-		input_str += _inputs[0]->name();
-		input_str += ") %s\n";
-		format_str = builder.CreateGlobalString(input_str);
-	}
-
-	auto format_addr = builder.CreateInBoundsGEP(format_str,
-										 {builder.getInt32(0), builder.getInt32(0)});
-
-	auto fn = program->name_space()->get_external_function("print",
-														   program->current_module(), context);
-
+	auto site = builder.getInt64(trace_log()->site(program->program_name(), _inputs[0]->name()));
 	if(_inputs[0]->type() == program->name_space()->type("string"))
 	{
 		//TODO other array types and user defined types?
-		auto array_ptr = _inputs[0]->fetch_value_raw(context, builder);
-		auto c_str = builder.CreateLoad
-			(builder.CreateStructGEP(_inputs[0]->type()->type(context), array_ptr, 0));
-
-		builder.CreateCall(fn, {format_addr, c_str});
+		auto fn = program->name_space()->get_external_function("trace_string",
+															   program->current_module(), context);
+		auto array = generate_array_fetch(context, builder, _inputs[0]);
+		auto data = builder.CreatePointerCast(array.first, llvm::Type::getInt8PtrTy(context));
+		builder.CreateCall(fn, {site, data, array.second});
 	}
 	else
 	{
-		builder.CreateCall(fn, {format_addr, _inputs[0]->fetch_value(context, builder)});
+		auto fn = program->name_space()->get_external_function("trace_real",
+															   program->current_module(), context);
+		builder.CreateCall(fn, {site, _inputs[0]->fetch_value(context, builder)});
 	}
 }
 
@@ -779,7 +1421,9 @@ void Schedule::generate_operation(llvm::LLVMContext &context, llvm::IRBuilder<>
 	auto state = program->current_state();
 	auto state_cast = builder.CreateBitCast(state, llvm::Type::getInt8PtrTy(context));
 	auto closure_cast = builder.CreateBitCast(closure, llvm::Type::getInt8PtrTy(context));
-	builder.CreateCall(fn, {scheduler, closure_cast, state_cast, time});
+	auto status = builder.CreateCall(fn, {scheduler, closure_cast, state_cast, time});
+	//the ScheduleStatus, this one fires now rather than when the closure runs
+	builder.CreateStore(status, _outputs[1]->fetch_value_raw(context, builder));
 }
 
 void Schedule::generate_prolouge(llvm::LLVMContext &context,
@@ -788,109 +1432,453 @@ void Schedule::generate_prolouge(llvm::LLVMContext &context,
 									llvm::BasicBlock *next_block)
 {
 	builder.CreateStore(llvm::ConstantInt::get(context, llvm::APInt(16, reset_mask)), _value);
+	//schedule_periodic has no status output
+	if(_outputs.size() > 1)
+		_outputs[1]->do_activations(context, builder);
 	builder.CreateBr(next_block);
 }
 
+llvm::Type* SchedulePeriodic::state_type(llvm::LLVMContext &context)
+{
+	if(_state_type)
+		return _state_type;
+
+	std::vector<llvm::Type*> data_types;
+	data_types.push_back(llvm::Type::getInt1Ty(context)); //armed
+
+	_state_type = llvm::StructType::create(context, data_types);
+	return _state_type;
+}
+
+void SchedulePeriodic::generate_operation(llvm::LLVMContext &context, llvm::IRBuilder<> &builder,
+										  Program *program)
+{
+	auto function = program->function_value();
+	auto arm_block = llvm::BasicBlock::Create(context, "periodic_arm", function);
+	auto done_block = llvm::BasicBlock::Create(context, "periodic_done", function);
+	auto armed_ptr = builder.CreateStructGEP(_state_type, _state_value, 0);
+	builder.CreateCondBr(builder.CreateLoad(armed_ptr), done_block, arm_block);
+
+	builder.SetInsertPoint(arm_block);
+	auto fn = program->name_space()->get_external_function
+		("schedule_periodic", program->current_module(), context);
+	auto closure = program->create_closure(_outputs[0], true,
+										   context, program->current_module());
+	auto scheduler_var = program->name_space()->get_external_variable
+		("scheduler", program->current_module(), context);
+
+	auto scheduler = builder.CreateLoad(scheduler_var);
+	auto period = _inputs[0]->fetch_value(context, builder);
+	auto state = program->current_state();
+	//the time this run was scheduled for, see Program::function_type
+	auto exec_time = builder.CreateLoad(builder.CreateStructGEP(program->state_type_value(),
+																state, 4));
+	auto state_cast = builder.CreateBitCast(state, llvm::Type::getInt8PtrTy(context));
+	auto closure_cast = builder.CreateBitCast(closure, llvm::Type::getInt8PtrTy(context));
+	builder.CreateCall(fn, {scheduler, closure_cast, state_cast, exec_time, period});
+	builder.CreateStore(builder.getInt1(true), armed_ptr);
+	builder.CreateBr(done_block);
+
+	builder.SetInsertPoint(done_block);
+}
+
 void Instruction::validate_mask()
 {
 	if(reset_mask == mask)
 		reset_mask = 0;
 }
 
-ArrayBuilder::ArrayBuilder(Type* array_type) : array_type(array_type), initializer(nullptr)
+void Instruction::replace_input(Register* from, Register* to)
+{
+	std::replace(_inputs.begin(), _inputs.end(), from, to);
+	std::replace(_deps.begin(), _deps.end(), from, to);
+}
+
+//64 bytes per iteration, one avx-512 register or two avx2 ones
+static const unsigned array_vector_bits = 512;
+
+//makes room for size elements in the array held by reg and sets its size. the
+//buffer is only reallocated when it is too small or shared with another register,
+//whatever was in there gets overwritten anyway so it isn't copied.
+//returns the data pointer.
+static llvm::Value* generate_array_resize(llvm::LLVMContext &context, llvm::IRBuilder<> &builder,
+										  Program* program, Register* reg,
+										  llvm::Type* element_type, llvm::Value* size)
 {
+	auto reserve = program->name_space()->get_external_function("array_reserve",
+																program->current_module(),
+																context);
+	auto out_struct = reg->fetch_value_raw(context, builder);
+	auto data = builder.CreateCall(reserve, {builder.CreatePointerCast
+				(out_struct, llvm::Type::getInt8PtrTy(context)),
+				size, llvm::ConstantExpr::getSizeOf(element_type)});
+	return builder.CreatePointerCast(data, element_type->getPointerTo());
 }
 
-ArrayBuilder::ArrayBuilder(Type* array_type, llvm::GlobalVariable* init) :
-	array_type(array_type), initializer(init)
+ArrayBuilder::ArrayBuilder(Type* array_type) : array_type(array_type)
 {
 }
 
+std::unique_ptr<Instruction> ArrayBuilder::fold(const std::vector<Instruction*>& inputs)
+{
+	if(array_type->name() != "real" || inputs.empty())
+		return nullptr;
+	std::vector<double> values;
+	for(auto& i: inputs)
+	{
+		if(!i->is_constant() || i->name() != "value_real")
+			return nullptr;
+		values.push_back(static_cast<ValueReal*>(i)->constant());
+	}
+	return std::make_unique<ValueArray>(values);
+}
+
 void ArrayBuilder::generate_operation(llvm::LLVMContext &context, llvm::IRBuilder<> &builder,
 									  xerxzema::Program *program)
 {
-	auto out_struct = _outputs[0]->fetch_value_raw(context, builder); //get a pointer to this
-	auto data_ptr = builder.CreateStructGEP(_outputs[0]->type()->type(context),
-											out_struct, 0);
-	auto val_ptr = builder.CreateLoad(data_ptr);
-	auto is_null = builder.CreateICmpEQ(val_ptr,
-										llvm::ConstantPointerNull::get
-										(array_type->type(context)->getPointerTo()));
+	//TODO
+	// we need an "after-head" sort of optimnization pass that can detect which items are only activated
+	// by head-fired registers and remove extra mask updates
+	auto element_type = array_type->type(context);
+	auto data = generate_array_resize(context, builder, program, _outputs[0], element_type,
+									  builder.getInt64(_inputs.size()));
+	for(size_t i = 0; i < _inputs.size(); i++)
+	{
+		array_type->copy(context, builder, program, builder.CreateGEP(data, builder.getInt64(i)),
+						 _inputs[i]->fetch_value_raw(context, builder));
+	}
+}
 
-	auto kill_block = llvm::BasicBlock::Create(context, "kill_array", program->function_value());
-	auto create_block = llvm::BasicBlock::Create(context, "create_array", program->function_value());
+ArrayArithmetic::ArrayArithmetic(ArrayOp o, Type* e, bool sl, bool sr) : op(o), element(e),
+																		  scalar_lhs(sl),
+																		  scalar_rhs(sr)
+{
+}
 
-	builder.CreateCondBr(is_null, create_block, kill_block);
+std::string ArrayArithmetic::name()
+{
+	switch(op)
+	{
+	case ArrayOp::Add: return "array_add";
+	case ArrayOp::Sub: return "array_sub";
+	case ArrayOp::Mul: return "array_mul";
+	case ArrayOp::Div: return "array_div";
+	case ArrayOp::Eq: return "array_eq";
+	case ArrayOp::Ne: return "array_ne";
+	case ArrayOp::Lt: return "array_lt";
+	case ArrayOp::Le: return "array_le";
+	case ArrayOp::Gt: return "array_gt";
+	case ArrayOp::Ge: return "array_ge";
+	}
+	return "array_undef";
+}
 
-	builder.SetInsertPoint(kill_block);
+bool ArrayArithmetic::is_compare()
+{
+	return op >= ArrayOp::Eq;
+}
 
+//works the same on scalars and vectors
+llvm::Value* ArrayArithmetic::generate_element(llvm::IRBuilder<> &builder,
+											   llvm::Value* lhs, llvm::Value* rhs)
+{
+	switch(op)
+	{
+	case ArrayOp::Add: return builder.CreateFAdd(lhs, rhs);
+	case ArrayOp::Sub: return builder.CreateFSub(lhs, rhs);
+	case ArrayOp::Mul: return builder.CreateFMul(lhs, rhs);
+	case ArrayOp::Div: return builder.CreateFDiv(lhs, rhs);
+	case ArrayOp::Eq: return builder.CreateFCmpOEQ(lhs, rhs);
+	case ArrayOp::Ne: return builder.CreateFCmpONE(lhs, rhs);
+	case ArrayOp::Lt: return builder.CreateFCmpOLT(lhs, rhs);
+	case ArrayOp::Le: return builder.CreateFCmpOLE(lhs, rhs);
+	case ArrayOp::Gt: return builder.CreateFCmpOGT(lhs, rhs);
+	case ArrayOp::Ge: return builder.CreateFCmpOGE(lhs, rhs);
+	}
+	return nullptr;
+}
 
-	auto mallocator = program->name_space()->get_external_function("malloc",
-																   program->current_module(),
-																   context);
-	//TODO move this to type destructor
-	auto deallocator = program->name_space()->get_external_function("free",
-																	program->current_module(),
-																	context);
-	if(array_type->is_trivial())
+void ArrayArithmetic::generate_operation(llvm::LLVMContext &context, llvm::IRBuilder<> &builder,
+										 xerxzema::Program *program)
+{
+	auto function = program->function_value();
+	auto real_type = element->type(context);
+	auto index_type = llvm::Type::getInt64Ty(context);
+	//real32 arrays get twice the lanes for the same bytes
+	unsigned element_bytes = real_type->getPrimitiveSizeInBits() / 8;
+	unsigned array_vector_width = array_vector_bits / 8 / element_bytes;
+	auto vector_type = llvm::VectorType::get(real_type, array_vector_width);
+	//bool arrays are stored a byte per element, <8 x i1> would get packed into bits
+	auto mask_type = llvm::VectorType::get(llvm::Type::getInt8Ty(context), array_vector_width);
+	auto element_type = is_compare() ? llvm::Type::getInt1Ty(context) : real_type;
+
+	//each side is either an array or a scalar splatted across the vector,
+	//the definition never lets both be scalars
+	llvm::Value* size = nullptr;
+	llvm::Value* data[2] = {nullptr, nullptr};
+	llvm::Value* values[2] = {nullptr, nullptr};
+	llvm::Value* vectors[2] = {nullptr, nullptr};
+	bool scalars[2] = {scalar_lhs, scalar_rhs};
+	for(int k = 0; k < 2; k++)
 	{
-		auto void_cast = builder.CreatePointerCast(val_ptr, llvm::Type::getInt8PtrTy(context));
-		builder.CreateCall(deallocator, {void_cast});
-		auto sz = llvm::ConstantExpr::getSizeOf(_outputs[0]->type()->type(context));
-		builder.CreateMemSet(out_struct, builder.getInt8(0), sz, 0);
-		builder.CreateBr(create_block);
+		if(scalars[k])
+		{
+			values[k] = _inputs[k]->fetch_value(context, builder);
+			vectors[k] = builder.CreateVectorSplat(array_vector_width, values[k]);
+		}
+		else
+		{
+			auto array = generate_array_fetch(context, builder, _inputs[k]);
+			data[k] = array.first;
+			if(size)
+				size = builder.CreateSelect(builder.CreateICmpSLT(array.second, size),
+											array.second, size);
+			else
+				size = array.second;
+		}
+	}
+
+	auto vector_cond = llvm::BasicBlock::Create(context, "array_vector_cond", function);
+	auto vector_body = llvm::BasicBlock::Create(context, "array_vector_body", function);
+	auto scalar_cond = llvm::BasicBlock::Create(context, "array_scalar_cond", function);
+	auto scalar_body = llvm::BasicBlock::Create(context, "array_scalar_body", function);
+	auto done_block = llvm::BasicBlock::Create(context, "array_done", function);
+
+	auto out_data = generate_array_resize(context, builder, program,
+										  _outputs[0], element_type, size);
+	auto ready_block = builder.GetInsertBlock();
+	auto vector_end = builder.CreateAnd(size, builder.getInt64(~(uint64_t)(array_vector_width - 1)));
+	builder.CreateBr(vector_cond);
+
+	builder.SetInsertPoint(vector_cond);
+	auto i = builder.CreatePHI(index_type, 2);
+	i->addIncoming(builder.getInt64(0), ready_block);
+	builder.CreateCondBr(builder.CreateICmpSLT(i, vector_end), vector_body, scalar_cond);
+
+	builder.SetInsertPoint(vector_body);
+	llvm::Value* vector_operands[2] = {vectors[0], vectors[1]};
+	for(int k = 0; k < 2; k++)
+	{
+		if(scalars[k])
+			continue;
+		auto ptr = builder.CreatePointerCast(builder.CreateGEP(data[k], i),
+											 vector_type->getPointerTo());
+		vector_operands[k] = builder.CreateAlignedLoad(ptr, element_bytes);
+	}
+	auto vector_result = generate_element(builder, vector_operands[0], vector_operands[1]);
+	auto out_element = builder.CreateGEP(out_data, i);
+	if(is_compare())
+	{
+		auto out_ptr = builder.CreatePointerCast(out_element, mask_type->getPointerTo());
+		builder.CreateAlignedStore(builder.CreateZExt(vector_result, mask_type), out_ptr, 1);
 	}
 	else
 	{
-		//for each blah, destroy blah
+		auto out_ptr = builder.CreatePointerCast(out_element, vector_type->getPointerTo());
+		builder.CreateAlignedStore(vector_result, out_ptr, element_bytes);
+	}
+	i->addIncoming(builder.CreateAdd(i, builder.getInt64(array_vector_width)), vector_body);
+	builder.CreateBr(vector_cond);
+
+	builder.SetInsertPoint(scalar_cond);
+	auto j = builder.CreatePHI(index_type, 2);
+	j->addIncoming(i, vector_cond);
+	builder.CreateCondBr(builder.CreateICmpSLT(j, size), scalar_body, done_block);
 
+	builder.SetInsertPoint(scalar_body);
+	llvm::Value* elements[2] = {values[0], values[1]};
+	for(int k = 0; k < 2; k++)
+	{
+		if(!scalars[k])
+			elements[k] = builder.CreateLoad(builder.CreateGEP(data[k], j));
 	}
+	auto scalar_result = generate_element(builder, elements[0], elements[1]);
+	builder.CreateStore(scalar_result, builder.CreateGEP(out_data, j));
+	j->addIncoming(builder.CreateAdd(j, builder.getInt64(1)), scalar_body);
+	builder.CreateBr(scalar_cond);
 
-	builder.SetInsertPoint(create_block);
-	//TODO
-	// we need an "after-head" sort of optimnization pass that can detect which items are only activated
-	// by head-fired registers and remove extra mask updates
+	builder.SetInsertPoint(done_block);
+}
+
+llvm::Type* Counter::state_type(llvm::LLVMContext &context)
+{
+	if(_state_type)
+		return _state_type;
+
+	std::vector<llvm::Type*> data_types;
+	data_types.push_back(llvm::Type::getDoubleTy(context));
+
+	_state_type = llvm::StructType::create(context, data_types);
+	return _state_type;
+}
 
-	//copy a global variable array in here inside of an elementwise build
-	if(initializer)
+void Counter::generate_operation(llvm::LLVMContext &context, llvm::IRBuilder<> &builder,
+								 Program *program)
+{
+	auto step = _inputs[0]->fetch_value(context, builder);
+	auto phase_ptr = builder.CreateStructGEP(_state_type, _state_value, 0);
+	auto phase = builder.CreateLoad(phase_ptr);
+
+	if(program->block_size() == 0)
 	{
-		auto element_count = initializer->getInitializer()->getType()->getArrayNumElements();
-		auto alloc_size = llvm::ConstantExpr::getMul
-			(llvm::ConstantExpr::getSizeOf(array_type->type(context)),
-			 builder.getInt64(element_count));
-		auto new_ptr = builder.CreateCall(mallocator, {alloc_size });
-		auto cast = builder.CreatePointerCast(new_ptr, array_type->type(context)->getPointerTo());
-		builder.CreateStore(cast, data_ptr);
-		auto dst_ptr = builder.CreateLoad(data_ptr);
-		builder.CreateMemCpy(dst_ptr, initializer, alloc_size, 0);
+		builder.CreateStore(phase, _outputs[0]->fetch_value_raw(context, builder));
+		builder.CreateStore(builder.CreateFAdd(phase, step), phase_ptr);
+		return;
 	}
-	else
+
+	auto function = program->function_value();
+	auto index_type = llvm::Type::getInt64Ty(context);
+	auto size = builder.getInt64(program->block_size());
+	auto out_data = generate_array_resize(context, builder, program, _outputs[0],
+										  llvm::Type::getDoubleTy(context), size);
+	auto ready_block = builder.GetInsertBlock();
+	auto body_block = llvm::BasicBlock::Create(context, "counter_body", function);
+	auto done_block = llvm::BasicBlock::Create(context, "counter_done", function);
+	builder.CreateBr(body_block);
+
+	//the block size is never 0 here so the check can go at the bottom
+	builder.SetInsertPoint(body_block);
+	auto i = builder.CreatePHI(index_type, 2);
+	auto current = builder.CreatePHI(phase->getType(), 2);
+	i->addIncoming(builder.getInt64(0), ready_block);
+	current->addIncoming(phase, ready_block);
+	builder.CreateStore(current, builder.CreateGEP(out_data, i));
+	auto next = builder.CreateFAdd(current, step);
+	auto next_i = builder.CreateAdd(i, builder.getInt64(1));
+	i->addIncoming(next_i, body_block);
+	current->addIncoming(next, body_block);
+	builder.CreateCondBr(builder.CreateICmpSLT(next_i, size), body_block, done_block);
+
+	builder.SetInsertPoint(done_block);
+	builder.CreateStore(next, phase_ptr);
+}
+
+ArrayReduce::ArrayReduce(const std::string& k) : kernel(k)
+{
+}
+
+void ArrayReduce::generate_operation(llvm::LLVMContext &context, llvm::IRBuilder<> &builder,
+									 xerxzema::Program *program)
+{
+	auto fn = program->name_space()->get_external_function(kernel, program->current_module(),
+														   context);
+	auto opaque_type = llvm::Type::getInt8PtrTy(context);
+	auto lhs = generate_array_fetch(context, builder, _inputs[0]);
+	std::vector<llvm::Value*> args{builder.CreatePointerCast(lhs.first, opaque_type)};
+	auto size = lhs.second;
+	if(_inputs.size() > 1)
 	{
-		auto alloc_size = llvm::ConstantExpr::getMul
-			(llvm::ConstantExpr::getSizeOf(array_type->type(context)),
-			 builder.getInt64(_inputs.size()));
-		auto new_ptr = builder.CreateCall(mallocator, {alloc_size });
-		auto cast = builder.CreatePointerCast(new_ptr, array_type->type(context)->getPointerTo());
-		builder.CreateStore(cast, data_ptr);
-		auto dst_ptr = builder.CreateLoad(data_ptr);
-		auto next_ptr = builder.CreateGEP(dst_ptr, builder.getInt32(0));
-		for(size_t i = 0; i < _inputs.size(); i++)
-		{
-			//TODO detect single-use copy or move?
-			array_type->copy(context, builder, program,
-							 dst_ptr, _inputs[i]->fetch_value_raw(context, builder));
-			next_ptr = builder.CreateGEP(dst_ptr, builder.getInt32(i));
-		}
+		auto rhs = generate_array_fetch(context, builder, _inputs[1]);
+		args.push_back(builder.CreatePointerCast(rhs.first, opaque_type));
+		size = builder.CreateSelect(builder.CreateICmpSLT(rhs.second, size), rhs.second, size);
 	}
+	args.push_back(size);
+	auto p = builder.CreateCall(fn, args);
+	builder.CreateStore(p, _outputs[0]->fetch_value_raw(context, builder));
+}
+
+ProgramMap::ProgramMap(Program* target) : ProgramDirectCall(target)
+{
+}
+
+std::string ProgramMap::name()
+{
+	return "map." + target->symbol_name();
+}
+
+void ProgramMap::generate_operation(llvm::LLVMContext &context, llvm::IRBuilder<> &builder,
+									xerxzema::Program *program)
+{
+	auto fn = target_function(context, program);
+	auto function = program->function_value();
+	auto target_type = target->state_type_value();
+	auto in_register = target->input_registers()[0];
+	auto out_register = target->output_registers()[0];
+	auto in_type = in_register->type();
+	auto out_type = out_register->type();
+
+	auto in = generate_array_fetch(context, builder, _inputs[0]);
+	auto out_data = generate_array_resize(context, builder, program, _outputs[0],
+										  out_type->type(context), in.second);
+	auto entry_block = builder.GetInsertBlock();
+
+	auto cond_block = llvm::BasicBlock::Create(context, "map_cond", function);
+	auto body_block = llvm::BasicBlock::Create(context, "map_body", function);
+	auto done_block = llvm::BasicBlock::Create(context, "map_done", function);
+	builder.CreateBr(cond_block);
+
+	builder.SetInsertPoint(cond_block);
+	auto i = builder.CreatePHI(llvm::Type::getInt64Ty(context), 2);
+	i->addIncoming(builder.getInt64(0), entry_block);
+	builder.CreateCondBr(builder.CreateICmpSLT(i, in.second), body_block, done_block);
+
+	builder.SetInsertPoint(body_block);
+	auto state = builder.CreateLoad(state_value());
+	in_type->copy(context, builder, program,
+				  builder.CreateStructGEP(target_type, state, in_register->offset()),
+				  builder.CreateGEP(in.first, i));
+	auto call_ret = builder.CreateCall(fn, {state});
+	builder.CreateStore(call_ret, state_value());
+	out_type->copy(context, builder, program, builder.CreateGEP(out_data, i),
+				   builder.CreateStructGEP(target_type, call_ret, out_register->offset()));
+	i->addIncoming(builder.CreateAdd(i, builder.getInt64(1)), body_block);
+	builder.CreateBr(cond_block);
 
-	//set the array size and allocated size
-	auto size_ptr = builder.CreateStructGEP(_outputs[0]->type()->type(context),
-											out_struct, 1);
-	auto alloc_ptr = builder.CreateStructGEP(_outputs[0]->type()->type(context),
-											out_struct, 2);
-	builder.CreateStore(builder.getInt64(_inputs.size()), size_ptr);
-	builder.CreateStore(builder.getInt64(_inputs.size()), alloc_ptr);
+	builder.SetInsertPoint(done_block);
+}
+
+ProgramFold::ProgramFold(Program* target) : ProgramDirectCall(target)
+{
+}
+
+std::string ProgramFold::name()
+{
+	return "fold." + target->symbol_name();
+}
+
+void ProgramFold::generate_operation(llvm::LLVMContext &context, llvm::IRBuilder<> &builder,
+									 xerxzema::Program *program)
+{
+	auto fn = target_function(context, program);
+	auto function = program->function_value();
+	auto target_type = target->state_type_value();
+	auto acc_register = target->input_registers()[0];
+	auto element_register = target->input_registers()[1];
+	auto out_register = target->output_registers()[0];
+	auto acc_type = acc_register->type();
+
+	//the output register doubles as the accumulator
+	auto acc = _outputs[0]->fetch_value_raw(context, builder);
+	acc_type->copy(context, builder, program, acc, _inputs[0]->fetch_value_raw(context, builder));
+	auto in = generate_array_fetch(context, builder, _inputs[1]);
+	auto entry_block = builder.GetInsertBlock();
+
+	auto cond_block = llvm::BasicBlock::Create(context, "fold_cond", function);
+	auto body_block = llvm::BasicBlock::Create(context, "fold_body", function);
+	auto done_block = llvm::BasicBlock::Create(context, "fold_done", function);
+	builder.CreateBr(cond_block);
+
+	builder.SetInsertPoint(cond_block);
+	auto i = builder.CreatePHI(llvm::Type::getInt64Ty(context), 2);
+	i->addIncoming(builder.getInt64(0), entry_block);
+	builder.CreateCondBr(builder.CreateICmpSLT(i, in.second), body_block, done_block);
+
+	builder.SetInsertPoint(body_block);
+	auto state = builder.CreateLoad(state_value());
+	acc_type->copy(context, builder, program,
+				   builder.CreateStructGEP(target_type, state, acc_register->offset()), acc);
+	element_register->type()->copy(context, builder, program,
+								   builder.CreateStructGEP(target_type, state,
+														   element_register->offset()),
+								   builder.CreateGEP(in.first, i));
+	auto call_ret = builder.CreateCall(fn, {state});
+	builder.CreateStore(call_ret, state_value());
+	acc_type->copy(context, builder, program, acc,
+				   builder.CreateStructGEP(target_type, call_ret, out_register->offset()));
+	i->addIncoming(builder.CreateAdd(i, builder.getInt64(1)), body_block);
+	builder.CreateBr(cond_block);
 
+	builder.SetInsertPoint(done_block);
 }
 
 };
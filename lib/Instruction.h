@@ -15,6 +15,18 @@ namespace xerxzema
 							Program* program);\
 	inline std::string name() { return N; } };
 
+#define DECL_REAL_INST(X, N) class X : public RealArithmetic {			\
+	llvm::Value* generate_value(llvm::LLVMContext& context, llvm::IRBuilder<> &builder, \
+								Program* program, llvm::Value* lhs, llvm::Value* rhs); \
+	double evaluate(double lhs, double rhs);							\
+	inline std::string name() { return N; } };
+
+#define DECL_INT_INST(X, N) class X : public IntArithmetic {			\
+	llvm::Value* generate_value(llvm::LLVMContext& context, llvm::IRBuilder<> &builder, \
+								Program* program, llvm::Value* lhs, llvm::Value* rhs); \
+	int64_t evaluate(int64_t lhs, int64_t rhs);							\
+	inline std::string name() { return N; } };
+
 class Register;
 class Program;
 class Instruction
@@ -45,7 +57,16 @@ public:
 		return _outputs;
 	}
 
+	inline std::vector<Register*>& dependencies()
+	{
+		return _deps;
+	}
+
+	inline uint16_t activation_mask() { return mask; }
+	inline uint16_t reset_activation_mask() { return reset_mask; }
+
 	virtual void validate_mask();
+	void replace_input(Register* from, Register* to);
 
 	inline uint32_t offset() { return _offset; }
 	inline void offset(uint32_t o)
@@ -54,6 +75,18 @@ public:
 	}
 
 	virtual bool is_ugen();
+	//instructions that do something other than write their outputs (io, calls, etc...)
+	//these are never removed by the optimizer even when nobody reads their outputs
+	virtual bool has_side_effects();
+	//outputs are written from outside of the program body (e.g. a scheduler closure)
+	virtual bool has_deferred_outputs();
+	//Value* style instructions that only write a literal
+	virtual bool is_constant();
+	//compile time evaluation, inputs are the constant instructions feeding each input.
+	//returns nullptr when this can't be folded.
+	virtual std::unique_ptr<Instruction> fold(const std::vector<Instruction*>& inputs);
+	//pure real math that the optimizer can collapse into a FusedReal
+	virtual bool is_fusable();
 
 	virtual llvm::Type* state_type(llvm::LLVMContext& context);
 
@@ -96,6 +129,10 @@ public:
 	inline void eof_value(llvm::Value* val ) { _eof_value = val; }
 
 protected:
+	//hands input[input] over to dst_ptr, moved when this is its last use
+	void transfer_input(llvm::LLVMContext& context, llvm::IRBuilder<> &builder,
+						Program* program, size_t input, llvm::Value* dst_ptr);
+
 	llvm::Value* _value;
 	llvm::Value* _state_value;
 	llvm::Value* _eof_value;
@@ -117,6 +154,8 @@ public:
 
 	inline std::string name() { return "value_real";}
 	inline std::string constant_description() { return std::to_string(value); }
+	inline bool is_constant() { return true; }
+	inline double constant() { return value; }
 private:
 	double value;
 };
@@ -129,6 +168,8 @@ public:
 							Program* program);
 	inline std::string name() { return "value_int";}
 	inline std::string constant_description() { return std::to_string(value); }
+	inline bool is_constant() { return true; }
+	inline int64_t constant() { return value; }
 private:
 	int64_t value;
 };
@@ -141,10 +182,27 @@ public:
 							Program* program);
 	inline std::string name() { return "value_string";}
 	inline std::string constant_description() { return value; }
+	inline bool is_constant() { return true; }
 private:
 	std::string value;
 };
 
+//an array.real literal. like strings it lives in a read only global and the
+//register just borrows it, see generate_borrowed_array
+class ValueArray : public Instruction
+{
+public:
+	ValueArray(const std::vector<double>& v);
+	void generate_operation(llvm::LLVMContext& context,	llvm::IRBuilder<> &builder,
+							Program* program);
+	inline std::string name() { return "value_array";}
+	std::string constant_description();
+	inline bool is_constant() { return true; }
+	inline const std::vector<double>& constant() { return values; }
+private:
+	std::vector<double> values;
+};
+
 
 class ProgramDirectCall : public Instruction
 {
@@ -163,13 +221,45 @@ public:
 								   llvm::Value* state_ptr);
 
 	std::string name();
-private:
+	inline bool has_side_effects() { return true; }
+protected:
+	llvm::Function* target_function(llvm::LLVMContext& context, Program* program);
 	Program* target;
 };
 
+//calls target once per element of the input array, the results land in the
+//output array. the target keeps its state between elements.
+class ProgramMap : public ProgramDirectCall
+{
+public:
+	ProgramMap(Program* target);
+	void generate_operation(llvm::LLVMContext& context,
+							llvm::IRBuilder<> &builder,
+							Program* program);
+	std::string name();
+};
+
+//acc = target(acc, x) for every x in the array, starting from the first input
+class ProgramFold : public ProgramDirectCall
+{
+public:
+	ProgramFold(Program* target);
+	void generate_operation(llvm::LLVMContext& context,
+							llvm::IRBuilder<> &builder,
+							Program* program);
+	std::string name();
+};
+
+//ramp generator, outputs its phase and then advances it by input[0].
+//in a block rate program it writes block_size() consecutive phases per activation,
+//accumulated the same way so the samples match the per sample version exactly.
 class Counter : public Instruction
 {
 public:
+	llvm::Type* state_type(llvm::LLVMContext& context);
+	void generate_operation(llvm::LLVMContext& context,
+							llvm::IRBuilder<> &builder,
+							Program* program);
 	inline bool is_ugen() { return true; }
 	inline std::string name() { return "counter";}
 
@@ -186,9 +276,43 @@ public:
 						   llvm::IRBuilder<> &builder,
 						   Program* program,
 						   llvm::BasicBlock* next_block);
+	void generate_state_destructor(llvm::LLVMContext& context,
+								   llvm::IRBuilder<> &builder,
+								   Program* program,
+								   llvm::Value* state_ptr);
 	inline std::string name() { return "delay";}
 };
 
+//delay(x, n), outputs x as it was n activations ago (0 before there is any history).
+//the history is a power of two ring buffer in the state, so a read and a write cost
+//the same no matter how long the delay is. it grows through xerxzema_delay_grow
+//when n asks for more than it holds. a real n reads between the two taps
+//around it with linear interpolation, an int n reads a single tap.
+class DelayLine : public Instruction
+{
+public:
+	DelayLine(bool interpolated);
+	llvm::Type* state_type(llvm::LLVMContext& context);
+	void generate_operation(llvm::LLVMContext& context,
+							llvm::IRBuilder<> &builder,
+							Program* program);
+	void generate_state_initializer(llvm::LLVMContext& context,
+									llvm::IRBuilder<> &builder,
+									Program* program);
+	void generate_state_destructor(llvm::LLVMContext& context,
+								   llvm::IRBuilder<> &builder,
+								   Program* program,
+								   llvm::Value* state_ptr);
+	inline std::string name() { return interpolated ? "delay_line_interp" : "delay_line";}
+	//sizes the ring for this tap when the state is initialized, for a literal n
+	//so the ring never has to grow while the program runs. -1 for none.
+	void reserve(double tap);
+	inline int64_t reserved() const { return reserved_tap; }
+private:
+	bool interpolated;
+	int64_t reserved_tap;
+};
+
 //input[0] is a bool, input[1] is any, output[0] == input[1]
 //when i[0] == True, input[0] is copied to output[0]
 //otherwise output[0] remains unchanges.
@@ -239,8 +363,11 @@ public:
 						   Program* program,
 						   llvm::BasicBlock* next_block);
 	inline std::string name() { return "trace";}
+	inline bool has_side_effects() { return true; }
 };
 
+//schedule_absolute(time) -> (tick, status), tick fires from the scheduler at
+//time and status fires right away with the ScheduleStatus from submitting it
 class Schedule : public Instruction
 {
 public:
@@ -252,6 +379,21 @@ public:
 						   Program* program,
 						   llvm::BasicBlock* next_block);
 	inline std::string name() { return "schedule";}
+	inline bool has_side_effects() { return true; }
+	inline bool has_deferred_outputs() { return true; }
+};
+
+//schedule_periodic(period) arms a scheduler timer the first time it fires,
+//after that the scheduler re-arms it itself so the program doesn't pay for
+//scheduling on every tick
+class SchedulePeriodic : public Schedule
+{
+public:
+	llvm::Type* state_type(llvm::LLVMContext& context);
+	void generate_operation(llvm::LLVMContext& context,
+							llvm::IRBuilder<> &builder,
+							Program* program);
+	inline std::string name() { return "schedule_periodic";}
 };
 
 class Merge : public Instruction
@@ -293,22 +435,139 @@ class ArrayBuilder : public Instruction
 {
 public:
 	ArrayBuilder(Type* type);
-	ArrayBuilder(Type* type, llvm::GlobalVariable* init);
 	void generate_operation(llvm::LLVMContext& context,
 							llvm::IRBuilder<> &builder,
 							Program* program);
+	//all constant reals become a ValueArray
+	std::unique_ptr<Instruction> fold(const std::vector<Instruction*>& inputs);
 	inline std::string name() { return "array_builder";}
 protected:
 	Type* array_type;
-	llvm::GlobalVariable* initializer;
 };
 
+enum class ArrayOp
+{
+	Add,
+	Sub,
+	Mul,
+	Div,
+	Eq,
+	Ne,
+	Lt,
+	Le,
+	Gt,
+	Ge
+};
+
+//array.real -> real reductions, the work happens in the runtime kernels
+//(see ArrayKernels.h) which split big arrays across the worker pool.
+//dot takes two arrays and uses the shorter length.
+class ArrayReduce : public Instruction
+{
+public:
+	ArrayReduce(const std::string& kernel);
+	void generate_operation(llvm::LLVMContext& context,
+							llvm::IRBuilder<> &builder,
+							Program* program);
+	inline std::string name() { return kernel; }
+private:
+	std::string kernel;
+};
+
+//elementwise math over array.real, either array op array (cut down to the shorter
+//of the two), array op real or real op array. the output is resized in place and only reallocated
+//when it has to grow. the loop body works on 64 byte vectors (8 reals, 16 real32s) which llvm
+//legalizes down to whatever the host has, the leftovers go through a scalar loop.
+//array.real32 works the same way with real32 scalars.
+//comparisons produce an array.bool.
+class ArrayArithmetic : public Instruction
+{
+public:
+	ArrayArithmetic(ArrayOp op, Type* element, bool scalar_lhs, bool scalar_rhs);
+	void generate_operation(llvm::LLVMContext& context,
+							llvm::IRBuilder<> &builder,
+							Program* program);
+	std::string name();
+	bool is_compare();
+private:
+	llvm::Value* generate_element(llvm::IRBuilder<> &builder, llvm::Value* lhs, llvm::Value* rhs);
+	ArrayOp op;
+	Type* element;
+	bool scalar_lhs;
+	bool scalar_rhs;
+};
+
+
+//binary real -> real operations, these can be folded when both inputs are constants
+class RealArithmetic : public Instruction
+{
+public:
+	void generate_operation(llvm::LLVMContext& context,
+							llvm::IRBuilder<> &builder,
+							Program* program);
+	std::unique_ptr<Instruction> fold(const std::vector<Instruction*>& inputs);
+	virtual llvm::Value* generate_value(llvm::LLVMContext& context,
+										llvm::IRBuilder<> &builder,
+										Program* program,
+										llvm::Value* lhs, llvm::Value* rhs) = 0;
+	virtual double evaluate(double lhs, double rhs) = 0;
+	inline bool is_fusable() { return true; }
+};
+
+DECL_REAL_INST(AddReal, "add")
+DECL_REAL_INST(SubReal, "sub")
+DECL_REAL_INST(MulReal, "mul")
+DECL_REAL_INST(DivReal, "div")
+DECL_REAL_INST(PowReal, "pow")
+//expression tree for a fused chain of arithmetic.
+//leaves index into the inputs of the owning FusedReal
+struct FusedNode
+{
+	std::unique_ptr<RealArithmetic> op;
+	size_t input;
+	std::unique_ptr<FusedNode> lhs;
+	std::unique_ptr<FusedNode> rhs;
+};
+
+//a chain of single consumer real ops collapsed into one instruction,
+//so we get one mask check and one store for the whole expression.
+//a*b+c and a*b-c are emitted as llvm.fmuladd unless the namespace is strict.
+class FusedReal : public Instruction
+{
+public:
+	FusedReal();
+	void generate_operation(llvm::LLVMContext& context,
+							llvm::IRBuilder<> &builder,
+							Program* program);
+	inline std::string name() { return "fused_real"; }
+	std::string constant_description();
+	inline bool is_fusable() { return true; }
+	inline void tree(std::unique_ptr<FusedNode>&& t) { root = std::move(t); }
+	inline std::unique_ptr<FusedNode> release_tree() { return std::move(root); }
+private:
+	llvm::Value* generate_node(llvm::LLVMContext& context,
+							   llvm::IRBuilder<> &builder,
+							   Program* program,
+							   FusedNode* node);
+	std::string describe_node(FusedNode* node);
+	std::unique_ptr<FusedNode> root;
+};
+
+//x^n for a small integer n. pow with a literal exponent gets rewritten into this
+//in fast float mode, llvm expands powi into a multiply chain.
+class PowiReal : public Instruction
+{
+public:
+	PowiReal(int32_t exponent);
+	void generate_operation(llvm::LLVMContext& context,
+							llvm::IRBuilder<> &builder,
+							Program* program);
+	inline std::string name() { return "powi_real"; }
+	inline std::string constant_description() { return std::to_string(exponent); }
+private:
+	int32_t exponent;
+};
 
-DECL_INST(AddReal, "add")
-DECL_INST(SubReal, "sub")
-DECL_INST(MulReal, "mul")
-DECL_INST(DivReal, "div")
-DECL_INST(PowReal, "pow")
 DECL_INST(EqReal, "eq")
 DECL_INST(NeReal, "ne")
 DECL_INST(LtReal, "lt")
@@ -316,5 +575,85 @@ DECL_INST(LeReal, "le")
 DECL_INST(GtReal, "gt")
 DECL_INST(GeReal, "ge")
 
+//real32(x) and real(x), rounds to nearest going down to real32
+class ConvertReal : public Instruction
+{
+public:
+	void generate_operation(llvm::LLVMContext& context,
+							llvm::IRBuilder<> &builder,
+							Program* program);
+	inline std::string name() { return "convert_real"; }
+};
+
+//vecN(a, b, ...) takes one real per lane, vecN(x) puts x in every lane
+class VectorBuild : public Instruction
+{
+public:
+	void generate_operation(llvm::LLVMContext& context,
+							llvm::IRBuilder<> &builder,
+							Program* program);
+	inline std::string name() { return "vector_build"; }
+};
+
+//extract(v, i) reads lane i, the index wraps around the width of v
+class VectorExtract : public Instruction
+{
+public:
+	void generate_operation(llvm::LLVMContext& context,
+							llvm::IRBuilder<> &builder,
+							Program* program);
+	inline std::string name() { return "extract"; }
+};
+
+//shuffle(v, 3, 2, 1, 0) picks lanes of v by literal index, the number of
+//lanes picked is the width of the result. see VectorShuffleDefinition
+class VectorShuffle : public Instruction
+{
+public:
+	VectorShuffle(const std::vector<uint32_t>& mask);
+	void generate_operation(llvm::LLVMContext& context,
+							llvm::IRBuilder<> &builder,
+							Program* program);
+	inline std::string name() { return "shuffle"; }
+	std::string constant_description();
+private:
+	std::vector<uint32_t> mask;
+};
+
+//binary int -> int operations, all of these wrap around on overflow like the
+//machine does. division and modulo by zero give 0 instead of trapping,
+//and shift amounts are taken modulo 64.
+class IntArithmetic : public Instruction
+{
+public:
+	void generate_operation(llvm::LLVMContext& context,
+							llvm::IRBuilder<> &builder,
+							Program* program);
+	std::unique_ptr<Instruction> fold(const std::vector<Instruction*>& inputs);
+	virtual llvm::Value* generate_value(llvm::LLVMContext& context,
+										llvm::IRBuilder<> &builder,
+										Program* program,
+										llvm::Value* lhs, llvm::Value* rhs) = 0;
+	virtual int64_t evaluate(int64_t lhs, int64_t rhs) = 0;
+};
+
+DECL_INT_INST(AddInt, "add")
+DECL_INT_INST(SubInt, "sub")
+DECL_INT_INST(MulInt, "mul")
+DECL_INT_INST(DivInt, "div")
+DECL_INT_INST(ModInt, "mod")
+DECL_INT_INST(AndInt, "band")
+DECL_INT_INST(OrInt, "bor")
+DECL_INT_INST(XorInt, "bxor")
+DECL_INT_INST(ShlInt, "shl")
+DECL_INT_INST(ShrInt, "shr")
+
+DECL_INST(EqInt, "eq")
+DECL_INST(NeInt, "ne")
+DECL_INST(LtInt, "lt")
+DECL_INST(LeInt, "le")
+DECL_INST(GtInt, "gt")
+DECL_INST(GeInt, "ge")
+
 
 };
@@ -3,6 +3,7 @@
 #include "World.h"
 #include "llvm/Analysis/Passes.h"
 #include "RT.h"
+#include "Optimizer.h"
 
 #include "llvm/ExecutionEngine/ExecutionEngine.h"
 #include "llvm/ExecutionEngine/RuntimeDyld.h"
@@ -14,6 +15,7 @@
 #include "llvm/IR/Verifier.h"
 #include "llvm/Support/DynamicLibrary.h"
 #include "llvm/Support/Error.h"
+#include "llvm/Support/Host.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Target/TargetMachine.h"
 #include "llvm/Transforms/Scalar.h"
@@ -39,6 +41,25 @@ namespace xerxzema
 
 
 
+//target the cpu we're running on instead of generic x86-64 so vector code
+//(array kernels especially) gets avx2/avx-512 when it's there.
+static llvm::TargetMachine* select_host_target()
+{
+	llvm::StringMap<bool> host_features;
+	std::vector<std::string> attrs;
+	if(llvm::sys::getHostCPUFeatures(host_features))
+	{
+		for(auto& feature: host_features)
+		{
+			attrs.push_back((feature.second ? "+" : "-") + feature.first().str());
+		}
+	}
+	return llvm::EngineBuilder()
+		.setMCPU(llvm::sys::getHostCPUName())
+		.setMAttrs(attrs)
+		.selectTarget();
+}
+
 static llvm::RuntimeDyld::SymbolInfo get_symbol(void* addr)
 {
 	return llvm::RuntimeDyld::SymbolInfo((uint64_t)addr, llvm::JITSymbolFlags::Exported);
@@ -50,10 +71,56 @@ static llvm::RuntimeDyld::SymbolInfo get_symbol(llvm::orc::JITSymbol& symbol)
 }
 
 
+//remembers where each object's sections went so they can be touched once
+//relocation is done, the first run of a program then doesn't page fault its way
+//through freshly mapped code
+class PrefaultMemoryManager : public llvm::SectionMemoryManager
+{
+public:
+	uint8_t* allocateCodeSection(uintptr_t size, unsigned alignment, unsigned id,
+								 llvm::StringRef name) override
+	{
+		auto memory = llvm::SectionMemoryManager::allocateCodeSection(size, alignment, id, name);
+		sections.push_back({memory, size, false});
+		return memory;
+	}
+
+	uint8_t* allocateDataSection(uintptr_t size, unsigned alignment, unsigned id,
+								 llvm::StringRef name, bool read_only) override
+	{
+		auto memory = llvm::SectionMemoryManager::allocateDataSection(size, alignment, id,
+																	   name, read_only);
+		sections.push_back({memory, size, !read_only});
+		return memory;
+	}
+
+	bool finalizeMemory(std::string* error = nullptr) override
+	{
+		auto failed = llvm::SectionMemoryManager::finalizeMemory(error);
+		if(!failed)
+		{
+			for(auto& section: sections)
+				prefault(section.memory, section.size, section.writable);
+		}
+		sections.clear();
+		return failed;
+	}
+
+private:
+	struct Section
+	{
+		uint8_t* memory;
+		size_t size;
+		bool writable;
+	};
+	std::vector<Section> sections;
+};
+
 Jit::Jit(World* world) : _world(world),
 						 dump_pre_optimization(false),
 						 dump_post_optimization(false),
-						 target_machine(llvm::EngineBuilder().selectTarget()),
+						 optimize_programs(true),
+						 target_machine(select_host_target()),
 						 data_layout(target_machine->createDataLayout()),
 						 compiler(linker, llvm::orc::SimpleCompiler(*target_machine)),
 						 optimizer(compiler, JitOptimizer())
@@ -81,6 +148,15 @@ void Jit::compile_namespace(Namespace* ns)
 	auto module = create_module(ns);
 	auto programs = ns->get_programs();
 
+	//run these before any codegen, direct calls need the final state layout of the target
+	if(optimize_programs)
+	{
+		for(auto p: programs)
+		{
+			Optimizer program_optimizer(p);
+			program_optimizer.run();
+		}
+	}
 
 	for(auto p: programs)
 	{
@@ -93,8 +169,13 @@ void Jit::compile_namespace(Namespace* ns)
 
 	module_set.push_back(std::move(module));
 
-	optimizer.addModuleSet(std::move(module_set),
-						  std::make_unique<llvm::SectionMemoryManager>(),
+	std::unique_ptr<llvm::SectionMemoryManager> memory;
+	if(_world->scheduler()->config().prefault)
+		memory = std::make_unique<PrefaultMemoryManager>();
+	else
+		memory = std::make_unique<llvm::SectionMemoryManager>();
+
+	optimizer.addModuleSet(std::move(module_set), std::move(memory),
 						  std::make_unique<JitResolver>(_world));
 
 }
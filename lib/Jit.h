@@ -57,6 +57,7 @@ public:
 
 	inline void dump_after_codegen() { dump_pre_optimization = true; }
 	inline void dump_after_optimization() { dump_post_optimization = true; }
+	inline void disable_program_optimizer() { optimize_programs = false; }
 	size_t get_state_size(Program* program);
 	void* get_state_offset(void* state, Program* program, int field);
 	inline World* world() { return _world; }
@@ -68,6 +69,7 @@ private:
 	World* _world;
 	bool dump_pre_optimization;
 	bool dump_post_optimization;
+	bool optimize_programs;
 
 	std::unique_ptr<llvm::TargetMachine> target_machine;
 	llvm::DataLayout data_layout;
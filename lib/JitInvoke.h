@@ -9,6 +9,8 @@
 namespace xerxzema
 {
 //TODO better handing of void args and some compile time tests
+//arguments and results are copied in and out of the state by value, array
+//registers need a type whose copies go through array_assign
 template<class R, class... Ts>
 class JitInvoke
 {
@@ -7,14 +7,22 @@
 namespace xerxzema
 {
 
-Namespace::Namespace(World* w, const std::string& n) : _world(w), _name(n), parent(nullptr)
+Namespace::Namespace(World* w, const std::string& n) : _world(w), _name(n), parent(nullptr),
+															_float_mode(FloatMode::Contract)
 {
 }
 
-Namespace::Namespace(World* w, const std::string& n, Namespace* p) : _world(w), _name(n), parent(p)
+//child namespaces start out with whatever mode the parent had when they were created
+Namespace::Namespace(World* w, const std::string& n, Namespace* p) : _world(w), _name(n), parent(p),
+																	   _float_mode(p->float_mode())
 {
 }
 
+void Namespace::float_mode(FloatMode mode)
+{
+	_float_mode = mode;
+}
+
 Namespace::~Namespace()
 {
 }
@@ -160,6 +168,8 @@ Type* Namespace::type(const std::string& name, const std::vector<Type*> params)
 {
 	if(parameterized_types.find(name) != parameterized_types.end())
 	{
+		if(!parameterized_types[name]->accepts(params))
+			return nullptr;
 		auto instance = parameterized_types[name]->instantiate(params);
 		if(parameterized_type_instances.find(instance->name()) ==
 		   parameterized_type_instances.end())
@@ -275,9 +285,69 @@ std::vector<Type*> ProgramCallDefinition::output_types(const std::vector<Type*>&
 }
 
 
+ProgramMapDefinition::ProgramMapDefinition(Program* target): target(target) {}
+std::string ProgramMapDefinition::name()
+{
+	return "map." + target->program_name();
+}
+
+bool ProgramMapDefinition::match(const std::vector<Type *> &inputs, xerxzema::Namespace *parent)
+{
+	auto& ins = target->input_registers();
+	if(inputs.size() != 1 || ins.size() != 1 || target->output_registers().size() != 1)
+		return false;
+	if(!target->output_registers()[0]->type()->is_trivial())
+		return false;
+	return inputs[0]->name() == "array." + ins[0]->type()->name();
+}
+
+std::vector<Type*> ProgramMapDefinition::output_types(const std::vector<Type*>& inputs,
+													  Namespace* parent)
+{
+	return std::vector<Type*>{parent->type("array", {target->output_registers()[0]->type()})};
+}
+
+std::unique_ptr<Instruction> ProgramMapDefinition::create(const std::vector<Type *> &inputs,
+														  const std::vector<Type *> &outputs)
+{
+	return std::make_unique<ProgramMap>(target);
+}
+
+ProgramFoldDefinition::ProgramFoldDefinition(Program* target): target(target) {}
+std::string ProgramFoldDefinition::name()
+{
+	return "fold." + target->program_name();
+}
+
+bool ProgramFoldDefinition::match(const std::vector<Type *> &inputs, xerxzema::Namespace *parent)
+{
+	auto& ins = target->input_registers();
+	auto& outs = target->output_registers();
+	if(inputs.size() != 2 || ins.size() != 2 || outs.size() != 1)
+		return false;
+	if(outs[0]->type() != ins[0]->type())
+		return false;
+	return inputs[0] == ins[0]->type() && inputs[1]->name() == "array." + ins[1]->type()->name();
+}
+
+std::vector<Type*> ProgramFoldDefinition::output_types(const std::vector<Type*>& inputs,
+													   Namespace* parent)
+{
+	return std::vector<Type*>{target->output_registers()[0]->type()};
+}
+
+std::unique_ptr<Instruction> ProgramFoldDefinition::create(const std::vector<Type *> &inputs,
+														   const std::vector<Type *> &outputs)
+{
+	return std::make_unique<ProgramFold>(target);
+}
+
 bool ArrayBuilderDefinition::match(const std::vector<Type *> &inputs, xerxzema::Namespace *parent)
 {
 	auto first_type = inputs[0];
+	//see Array::accepts
+	if(!first_type->is_trivial())
+		return false;
 	for(auto& next_type:inputs)
 	{
 		if(next_type != first_type)
@@ -299,6 +369,87 @@ std::unique_ptr<Instruction> ArrayBuilderDefinition::create(const std::vector<Ty
 }
 
 
+ArrayReduceDefinition::ArrayReduceDefinition(const std::string& name, size_t n) :
+	_name(name), arity(n)
+{
+}
+
+bool ArrayReduceDefinition::match(const std::vector<Type *> &inputs,
+								  xerxzema::Namespace *parent)
+{
+	if(inputs.size() != arity)
+		return false;
+	for(auto& t: inputs)
+	{
+		if(t->name() != "array.real")
+			return false;
+	}
+	return true;
+}
+
+std::vector<Type*> ArrayReduceDefinition::output_types(const std::vector<Type *> &inputs,
+													   xerxzema::Namespace *parent)
+{
+	return std::vector<Type*>{parent->type("real")};
+}
+
+std::unique_ptr<Instruction> ArrayReduceDefinition::create(const std::vector<Type *> &inputs,
+														   const std::vector<Type *> &outputs)
+{
+	return std::make_unique<ArrayReduce>("array_" + _name);
+}
+
+ArrayArithmeticDefinition::ArrayArithmeticDefinition(const std::string& name, ArrayOp o) :
+	_name(name), op(o)
+{
+}
+
+//the element type of the array side, real or real32
+static Type* array_element(const std::vector<Type *> &inputs)
+{
+	for(auto& t: inputs)
+	{
+		if(t->name().compare(0, 6, "array.") == 0)
+			return static_cast<ParameterizedType*>(t)->params()[0];
+	}
+	return nullptr;
+}
+
+bool ArrayArithmeticDefinition::match(const std::vector<Type *> &inputs,
+									  xerxzema::Namespace *parent)
+{
+	if(inputs.size() != 2)
+		return false;
+	auto element_type = array_element(inputs);
+	if(!element_type)
+		return false;
+	auto element = element_type->name();
+	if(element != "real" && element != "real32")
+		return false;
+	auto array = "array." + element;
+	auto lhs = inputs[0]->name();
+	auto rhs = inputs[1]->name();
+	if(lhs == array)
+		return rhs == array || rhs == element;
+	return lhs == element && rhs == array;
+}
+
+std::vector<Type*> ArrayArithmeticDefinition::output_types(const std::vector<Type *> &inputs,
+														   xerxzema::Namespace *parent)
+{
+	if(op >= ArrayOp::Eq)
+		return std::vector<Type*>{parent->type("array", {parent->type("bool")})};
+	return std::vector<Type*>{parent->type("array", {array_element(inputs)})};
+}
+
+std::unique_ptr<Instruction> ArrayArithmeticDefinition::create(const std::vector<Type *> &inputs,
+															   const std::vector<Type *> &outputs)
+{
+	auto element = array_element(inputs);
+	return std::make_unique<ArrayArithmetic>(op, element, inputs[0] == element,
+											 inputs[1] == element);
+}
+
 bool WhenDefinition::match(const std::vector<Type *> &inputs, xerxzema::Namespace *parent)
 {
 
@@ -370,6 +521,64 @@ std::unique_ptr<Instruction> DelayDefinition::create(const std::vector<Type *> &
 	return std::make_unique<Delay>();
 }
 
+bool DelayLineDefinition::match(const std::vector<Type *> &inputs, xerxzema::Namespace *parent)
+{
+	if(inputs.size() != 2 || inputs[0]->name() != "real")
+		return false;
+	return inputs[1]->name() == "real" || inputs[1]->name() == "int";
+}
+
+std::vector<Type*> DelayLineDefinition::output_types(const std::vector<Type *> &inputs,
+													 xerxzema::Namespace *parent)
+{
+	return std::vector<Type*>{inputs[0]};
+}
+
+std::unique_ptr<Instruction> DelayLineDefinition::create(const std::vector<Type *> &inputs,
+														 const std::vector<Type *> &outputs)
+{
+	return std::make_unique<DelayLine>(inputs[1]->name() == "real");
+}
+
+VectorShuffleDefinition::VectorShuffleDefinition(const std::vector<uint32_t>& m) : mask(m)
+{
+}
+
+std::string VectorShuffleDefinition::name()
+{
+	std::string n = "shuffle";
+	for(auto lane: mask)
+		n += "." + std::to_string(lane);
+	return n;
+}
+
+bool VectorShuffleDefinition::match(const std::vector<Type *> &inputs,
+									xerxzema::Namespace *parent)
+{
+	if(inputs.size() != 1 || vector_width(inputs[0]) == 0)
+		return false;
+	auto width = vector_width(inputs[0]);
+	for(auto lane: mask)
+	{
+		if(lane >= width)
+			return false;
+	}
+	//there is no vector type for every mask size
+	return output_types(inputs, parent)[0] != nullptr;
+}
+
+std::vector<Type*> VectorShuffleDefinition::output_types(const std::vector<Type *> &inputs,
+														 xerxzema::Namespace *parent)
+{
+	auto element = static_cast<Vector*>(inputs[0])->element();
+	return {parent->type("vec" + std::to_string(mask.size()) + "." + element->name())};
+}
+
+std::unique_ptr<Instruction> VectorShuffleDefinition::create(const std::vector<Type *> &inputs,
+															 const std::vector<Type *> &outputs)
+{
+	return std::make_unique<VectorShuffle>(mask);
+}
 
 bool MergeDefinition::match(const std::vector<Type *> &inputs, xerxzema::Namespace *parent)
 {
@@ -16,6 +16,19 @@ namespace xerxzema
 class World;
 class InstructionDefinition;
 class ExternalDefinition;
+
+//how much freedom codegen has with real math.
+//Strict: every op is rounded exactly as written.
+//Contract: a*b+c may be fused into an fma (the default).
+//Fast: reassociation, reciprocals and cheap pow lowering.
+//flushing denormals is up to the thread running the code, see SchedulerConfig.
+enum class FloatMode
+{
+	Strict,
+	Contract,
+	Fast
+};
+
 class Namespace
 {
 public:
@@ -40,8 +53,15 @@ public:
 	Program* get_program(const std::string& name);
 	Program* get_default_program();
 	bool is_program(const std::string& name);
+	inline FloatMode float_mode() const { return _float_mode; }
+	void float_mode(FloatMode mode);
 
 	void add_instruction(std::unique_ptr<InstructionDefinition>&& def);
+	//only looks at this namespace, not the imports
+	inline bool has_instruction(const std::string& name)
+	{
+		return instructions.find(name) != instructions.end();
+	}
 	InstructionDefinition* resolve_instruction(const std::string& name,
 											   const std::vector<Type*>& inputs);
 
@@ -76,6 +96,7 @@ private:
 	Namespace* parent;
 	std::string _name;
 	llvm::Value* scheduler;
+	FloatMode _float_mode;
 };
 
 
@@ -150,6 +171,37 @@ private:
 
 };
 
+//map.<program> and fold.<program>, the semantic layer rewrites map(f, xs) and
+//fold(f, init, xs) into these when f names a program.
+//map wants f: a -> b and takes array.a, fold wants f: (acc, a) -> acc.
+class ProgramMapDefinition : public InstructionDefinition
+{
+public:
+	ProgramMapDefinition(Program* target);
+	std::unique_ptr<Instruction> create(const std::vector<Type *> &inputs,
+										const std::vector<Type *> &outputs);
+	std::vector<Type*> output_types(const std::vector<Type*>& inputs, Namespace* parent);
+	bool match(const std::vector<Type*>& inputs, Namespace* parent);
+	std::string name();
+
+private:
+	Program* target;
+};
+
+class ProgramFoldDefinition : public InstructionDefinition
+{
+public:
+	ProgramFoldDefinition(Program* target);
+	std::unique_ptr<Instruction> create(const std::vector<Type *> &inputs,
+										const std::vector<Type *> &outputs);
+	std::vector<Type*> output_types(const std::vector<Type*>& inputs, Namespace* parent);
+	bool match(const std::vector<Type*>& inputs, Namespace* parent);
+	std::string name();
+
+private:
+	Program* target;
+};
+
 class ArrayBuilderDefinition : public InstructionDefinition
 {
 public:
@@ -160,6 +212,37 @@ public:
 	inline std::string name() { return "array"; }
 };
 
+//array.real op array.real, array.real op real and real op array.real, see ArrayArithmetic.
+//the same for array.real32 and real32
+class ArrayArithmeticDefinition : public InstructionDefinition
+{
+public:
+	ArrayArithmeticDefinition(const std::string& name, ArrayOp op);
+	std::unique_ptr<Instruction> create(const std::vector<Type *> &inputs,
+										const std::vector<Type *> &outputs);
+	std::vector<Type*> output_types(const std::vector<Type*>& inputs, Namespace* parent);
+	bool match(const std::vector<Type*>& inputs, Namespace* parent);
+	inline std::string name() { return _name; }
+private:
+	std::string _name;
+	ArrayOp op;
+};
+
+//sum, min, max and mean over one array.real, dot over two
+class ArrayReduceDefinition : public InstructionDefinition
+{
+public:
+	ArrayReduceDefinition(const std::string& name, size_t arity);
+	std::unique_ptr<Instruction> create(const std::vector<Type *> &inputs,
+										const std::vector<Type *> &outputs);
+	std::vector<Type*> output_types(const std::vector<Type*>& inputs, Namespace* parent);
+	bool match(const std::vector<Type*>& inputs, Namespace* parent);
+	inline std::string name() { return _name; }
+private:
+	std::string _name;
+	size_t arity;
+};
+
 class WhenDefinition : public InstructionDefinition
 {
 public:
@@ -210,6 +293,31 @@ public:
 	inline std::string name() { return "delay"; }
 };
 
+//delay(x:real, n:real) interpolates, delay(x:real, n:int) doesn't. see DelayLine
+class DelayLineDefinition : public InstructionDefinition
+{
+public:
+	std::unique_ptr<Instruction> create(const std::vector<Type *> &inputs,
+										const std::vector<Type *> &outputs);
+	std::vector<Type*> output_types(const std::vector<Type*>& inputs, Namespace* parent);
+	bool match(const std::vector<Type*>& inputs, Namespace* parent);
+	inline std::string name() { return "delay"; }
+};
+
+//one of these is made per lane mask, the semantic layer names it
+//shuffle.3.2.1.0 for shuffle(v, 3, 2, 1, 0). see VectorShuffle
+class VectorShuffleDefinition : public InstructionDefinition
+{
+public:
+	VectorShuffleDefinition(const std::vector<uint32_t>& mask);
+	std::unique_ptr<Instruction> create(const std::vector<Type *> &inputs,
+										const std::vector<Type *> &outputs);
+	std::vector<Type*> output_types(const std::vector<Type*>& inputs, Namespace* parent);
+	bool match(const std::vector<Type*>& inputs, Namespace* parent);
+	std::string name();
+private:
+	std::vector<uint32_t> mask;
+};
 
 template<class T>
 std::unique_ptr<BasicDefinition<T>> create_def(const std::string& name,
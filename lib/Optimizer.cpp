@@ -0,0 +1,496 @@
+#include "Optimizer.h"
+#include "Namespace.h"
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+
+namespace xerxzema
+{
+
+Optimizer::Optimizer(Program* program) : program(program), folded_instructions(0),
+										 merged_instructions(0), dead_instructions(0), lowered_instructions(0),
+										 sized_delays(0), fused_instructions(0), transient_registers(0)
+{
+
+}
+
+void Optimizer::run()
+{
+	fold_constants();
+	eliminate_common_subexpressions();
+	lower_constant_pow();
+	size_constant_delays();
+	eliminate_dead_instructions();
+	fuse_arithmetic();
+	demote_transient_registers();
+}
+
+bool Optimizer::is_program_output(Register* reg)
+{
+	auto& outs = program->output_registers();
+	return std::find(outs.begin(), outs.end(), reg) != outs.end();
+}
+
+bool Optimizer::is_live(Instruction* inst)
+{
+	if(inst->has_side_effects())
+		return true;
+
+	for(auto& r: inst->outputs())
+	{
+		if(is_program_output(r))
+			return true;
+		for(auto& activate: r->activations)
+		{
+			//feeding ourselves doesn't count as a use
+			if(activate.instruction != inst)
+				return true;
+		}
+	}
+	return false;
+}
+
+void Optimizer::eliminate_dead_instructions()
+{
+	//removing an instruction drops its activations from the input registers
+	//which can kill whatever was producing them, so keep going until nothing changes
+	bool changed = true;
+	while(changed)
+	{
+		changed = false;
+		std::vector<Instruction*> dead;
+		for(auto& inst: program->instruction_listing())
+		{
+			if(!is_live(inst.get()))
+				dead.push_back(inst.get());
+		}
+		for(auto inst: dead)
+		{
+			program->remove_instruction(inst);
+			dead_instructions++;
+			changed = true;
+		}
+	}
+}
+
+void Optimizer::find_producers()
+{
+	producers.clear();
+	for(auto& inst: program->instruction_listing())
+	{
+		for(auto& r: inst->outputs())
+		{
+			producers[r].push_back(inst.get());
+		}
+	}
+}
+
+Instruction* Optimizer::sole_producer(Register* reg)
+{
+	auto it = producers.find(reg);
+	if(it == producers.end() || it->second.size() != 1)
+		return nullptr;
+	return it->second[0];
+}
+
+//only literals that fire off of head, anything with a with-clause
+//attached to it fires later and has to stay put.
+Instruction* Optimizer::constant_producer(Register* reg)
+{
+	auto inst = sole_producer(reg);
+	if(!inst || !inst->is_constant())
+		return nullptr;
+	auto& deps = inst->dependencies();
+	if(deps.size() != 1 || deps[0] != program->reg("head"))
+		return nullptr;
+	return inst;
+}
+
+void Optimizer::fold_constants()
+{
+	auto head = program->reg("head");
+	find_producers();
+
+	bool changed = true;
+	while(changed)
+	{
+		changed = false;
+		std::vector<Instruction*> candidates;
+		for(auto& inst: program->instruction_listing())
+		{
+			if(!inst->is_constant() && !inst->has_side_effects() &&
+			   inst->outputs().size() == 1 &&
+			   inst->dependencies().size() == inst->inputs().size())
+				candidates.push_back(inst.get());
+		}
+
+		for(auto inst: candidates)
+		{
+			std::vector<Instruction*> values;
+			for(auto& r: inst->inputs())
+			{
+				auto value = constant_producer(r);
+				if(!value)
+					break;
+				values.push_back(value);
+			}
+			if(values.size() != inst->inputs().size())
+				continue;
+
+			auto folded = inst->fold(values);
+			if(!folded)
+				continue;
+
+			auto out = inst->outputs()[0];
+			folded->dependent(head);
+			folded->output(out);
+			folded->validate_mask();
+			std::replace(producers[out].begin(), producers[out].end(), inst, folded.get());
+			program->replace_instruction(inst, std::move(folded));
+			folded_instructions++;
+			changed = true;
+		}
+	}
+}
+
+bool Optimizer::can_merge(Instruction* inst)
+{
+	if(inst->has_side_effects() || inst->has_deferred_outputs())
+		return false;
+
+	for(auto& r: inst->outputs())
+	{
+		if(is_program_output(r) || !sole_producer(r))
+			return false;
+	}
+	return true;
+}
+
+//two instructions are the same if they run the same operation over the same
+//registers with the same activation rules. diff_description already leaves out the
+//outputs for anything that isn't a literal, literals get keyed on their value.
+std::string Optimizer::merge_key(Instruction* inst)
+{
+	std::stringstream ss;
+	if(inst->is_constant())
+	{
+		ss << inst->name() << "(" << inst->constant_description() << ") { deps: ";
+		for(auto& r: inst->dependencies())
+		{
+			ss << r->name() << ' ';
+		}
+		ss << "}";
+	}
+	else
+	{
+		ss << inst->diff_description();
+	}
+	ss << " activate: " << inst->activation_mask();
+	ss << " reset: " << inst->reset_activation_mask();
+	return ss.str();
+}
+
+void Optimizer::merge(Instruction* keep, Instruction* dup)
+{
+	auto it = keep->outputs().begin();
+	for(auto& from: dup->outputs())
+	{
+		auto to = *it++;
+		for(auto& activate: from->activations)
+		{
+			activate.instruction->replace_input(from, to);
+			to->activations.push_back(activate);
+		}
+		from->activations.clear();
+	}
+	program->remove_instruction(dup);
+}
+
+void Optimizer::eliminate_common_subexpressions()
+{
+	//merging makes the consumers of the duplicate read the same registers as the
+	//consumers of the original, which can make those identical too.
+	bool changed = true;
+	while(changed)
+	{
+		changed = false;
+		find_producers();
+		std::map<std::string, Instruction*> seen;
+		for(auto& inst: program->instruction_listing())
+		{
+			if(!can_merge(inst.get()))
+				continue;
+			auto key = merge_key(inst.get());
+			auto it = seen.find(key);
+			if(it == seen.end())
+			{
+				seen.emplace(key, inst.get());
+			}
+			else if(it->second->outputs().size() == inst->outputs().size())
+			{
+				merge(it->second, inst.get());
+				merged_instructions++;
+				changed = true;
+				break;
+			}
+		}
+	}
+}
+
+//anything past this is better off going through llvm.pow
+static const double max_powi_exponent = 16;
+
+//in fast mode x^n with a literal integer n becomes a multiply chain.
+//the literal is left for dce to clean up.
+void Optimizer::lower_constant_pow()
+{
+	if(program->name_space()->float_mode() != FloatMode::Fast)
+		return;
+
+	find_producers();
+	std::vector<Instruction*> candidates;
+	for(auto& inst: program->instruction_listing())
+	{
+		if(inst->name() == "pow" && inst->inputs().size() == 2 &&
+		   inst->dependencies().size() == inst->inputs().size())
+			candidates.push_back(inst.get());
+	}
+
+	for(auto inst: candidates)
+	{
+		auto value = constant_producer(inst->inputs()[1]);
+		if(!value || value->name() != "value_real")
+			continue;
+		auto exponent = static_cast<ValueReal*>(value)->constant();
+		if(exponent != std::trunc(exponent) || std::fabs(exponent) > max_powi_exponent)
+			continue;
+
+		auto base = inst->inputs()[0];
+		auto out = inst->outputs()[0];
+		std::unique_ptr<Instruction> lowered = std::make_unique<PowiReal>((int32_t)exponent);
+		if(inst->reset_activation_mask() & 1)
+			lowered->sample(base);
+		else
+			lowered->input(base);
+		lowered->output(out);
+		lowered->validate_mask();
+		std::replace(producers[out].begin(), producers[out].end(), inst, lowered.get());
+		program->replace_instruction(inst, std::move(lowered));
+		lowered_instructions++;
+	}
+}
+
+//a delay with a literal length gets its ring when the state is initialized
+//instead of growing it from inside the first callback that runs it
+void Optimizer::size_constant_delays()
+{
+	find_producers();
+	for(auto& inst: program->instruction_listing())
+	{
+		if(inst->name() != "delay_line" && inst->name() != "delay_line_interp")
+			continue;
+		auto value = constant_producer(inst->inputs()[1]);
+		if(!value)
+			continue;
+		auto delay = static_cast<DelayLine*>(inst.get());
+		if(value->name() == "value_int")
+			delay->reserve((double)static_cast<ValueInt*>(value)->constant());
+		else if(value->name() == "value_real")
+			delay->reserve(static_cast<ValueReal*>(value)->constant());
+		else
+			continue;
+		sized_delays++;
+	}
+}
+
+//the activation masks are 16 bits wide
+static const size_t max_fused_dependencies = 16;
+
+bool Optimizer::can_fuse(Instruction* producer, Instruction* consumer, Register* reg)
+{
+	if(!producer || producer == consumer || !producer->is_fusable())
+		return false;
+	if(is_program_output(reg) || reg->activations.size() != 1)
+		return false;
+
+	//the consumer has to be triggered by the producer, if it samples the value
+	//it can fire without the producer and we'd be recomputing with newer inputs.
+	auto& activate = reg->activations[0];
+	if(activate.instruction != consumer)
+		return false;
+	if(consumer->reset_activation_mask() & activate.value)
+		return false;
+
+	//with-clauses and friends don't map onto the expression tree
+	if(producer->dependencies().size() != producer->inputs().size() ||
+	   consumer->dependencies().size() != consumer->inputs().size())
+		return false;
+
+	return producer->inputs().size() + consumer->inputs().size() - 1 <= max_fused_dependencies;
+}
+
+static std::unique_ptr<FusedNode> make_tree(std::unique_ptr<Instruction>&& inst)
+{
+	if(inst->name() == "fused_real")
+		return static_cast<FusedReal*>(inst.get())->release_tree();
+
+	auto node = std::make_unique<FusedNode>();
+	node->op = std::unique_ptr<RealArithmetic>(static_cast<RealArithmetic*>(inst.release()));
+	node->lhs = std::make_unique<FusedNode>();
+	node->lhs->input = 0;
+	node->rhs = std::make_unique<FusedNode>();
+	node->rhs->input = 1;
+	return node;
+}
+
+static void shift_leaves(FusedNode* node, size_t first, size_t amount)
+{
+	if(node->op)
+	{
+		shift_leaves(node->lhs.get(), first, amount);
+		shift_leaves(node->rhs.get(), first, amount);
+	}
+	else if(node->input >= first)
+	{
+		node->input += amount;
+	}
+}
+
+static void substitute_leaf(std::unique_ptr<FusedNode>& node, size_t input,
+							std::unique_ptr<FusedNode>& subtree)
+{
+	if(node->op)
+	{
+		substitute_leaf(node->lhs, input, subtree);
+		substitute_leaf(node->rhs, input, subtree);
+	}
+	else if(node->input == input && subtree)
+	{
+		node = std::move(subtree);
+	}
+}
+
+//splice the producer's tree into the consumer at the given input slot.
+//the producer's inputs take the place of that slot in the fused input list.
+void Optimizer::fuse(Instruction* producer, Instruction* consumer, size_t input)
+{
+	std::vector<std::pair<Register*, bool>> fused_inputs;
+	auto collect = [&fused_inputs](Instruction* inst, size_t first, size_t last)
+	{
+		for(size_t i = first; i < last; i++)
+		{
+			bool sampled = inst->reset_activation_mask() & (1 << i);
+			fused_inputs.push_back({inst->inputs()[i], sampled});
+		}
+	};
+	collect(consumer, 0, input);
+	collect(producer, 0, producer->inputs().size());
+	collect(consumer, input + 1, consumer->inputs().size());
+	auto out = consumer->outputs()[0];
+	auto producer_inputs = producer->inputs().size();
+
+	auto fused = std::make_unique<FusedReal>();
+	auto fused_inst = fused.get();
+	auto consumer_owned = program->replace_instruction(consumer, std::move(fused));
+	auto producer_owned = program->release_instruction(producer);
+
+	auto tree = make_tree(std::move(consumer_owned));
+	auto subtree = make_tree(std::move(producer_owned));
+	shift_leaves(tree.get(), input + 1, producer_inputs - 1);
+	shift_leaves(subtree.get(), 0, input);
+	substitute_leaf(tree, input, subtree);
+	fused_inst->tree(std::move(tree));
+
+	for(auto& r: fused_inputs)
+	{
+		if(r.second)
+			fused_inst->sample(r.first);
+		else
+			fused_inst->input(r.first);
+	}
+	fused_inst->output(out);
+	fused_inst->validate_mask();
+}
+
+void Optimizer::fuse_arithmetic()
+{
+	bool changed = true;
+	while(changed)
+	{
+		changed = false;
+		find_producers();
+		for(auto& inst: program->instruction_listing())
+		{
+			auto consumer = inst.get();
+			if(!consumer->is_fusable())
+				continue;
+			auto& ins = consumer->inputs();
+			for(size_t i = 0; i < ins.size(); i++)
+			{
+				auto producer = sole_producer(ins[i]);
+				if(can_fuse(producer, consumer, ins[i]))
+				{
+					fuse(producer, consumer, i);
+					fused_instructions++;
+					changed = true;
+					break;
+				}
+			}
+			if(changed)
+				break;
+		}
+	}
+}
+
+//a register is transient when every consumer is guaranteed to fire during the same
+//activation as the one producer. that means each consumer is triggered (not sampled)
+//by it and every other dependency of the consumer comes out of the same producer.
+bool Optimizer::is_transient(Register* reg)
+{
+	if(!reg->type() || reg->type()->name() == "unit")
+		return false;
+
+	//non trivial types own memory that has to be carried around and destroyed
+	if(!reg->type()->is_trivial())
+		return false;
+
+	auto it = producers.find(reg);
+	if(it == producers.end())
+		return reg->activations.empty();
+
+	if(it->second.size() != 1)
+		return false;
+
+	auto producer = it->second[0];
+	if(producer->has_deferred_outputs())
+		return false;
+
+	auto& produced = producer->outputs();
+	for(auto& activate: reg->activations)
+	{
+		auto consumer = activate.instruction;
+		if(consumer->reset_activation_mask() & activate.value)
+			return false;
+		if(!(consumer->activation_mask() & activate.value))
+			return false;
+		for(auto& dep: consumer->dependencies())
+		{
+			if(std::find(produced.begin(), produced.end(), dep) == produced.end())
+				return false;
+		}
+	}
+	return true;
+}
+
+void Optimizer::demote_transient_registers()
+{
+	find_producers();
+	for(auto r: program->local_registers())
+	{
+		r->transient(is_transient(r));
+		if(r->is_transient())
+			transient_registers++;
+	}
+}
+
+};
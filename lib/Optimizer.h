@@ -0,0 +1,61 @@
+#pragma once
+#include <vector>
+#include <map>
+#include <string>
+
+#include "Program.h"
+
+namespace xerxzema
+{
+
+//Program level passes that run after semantic analysis and before codegen.
+//Everything in here works on the instruction graph (registers + activations),
+//llvm never gets to see the values we keep in the state struct so it can't
+//do any of this for us.
+class Optimizer
+{
+public:
+	Optimizer(Program* program);
+
+	void run();
+	void fold_constants();
+	void eliminate_common_subexpressions();
+	void lower_constant_pow();
+	void size_constant_delays();
+	void eliminate_dead_instructions();
+	void fuse_arithmetic();
+	void demote_transient_registers();
+
+	inline size_t get_folded_instruction_count() { return folded_instructions; }
+	inline size_t get_merged_instruction_count() { return merged_instructions; }
+	inline size_t get_dead_instruction_count() { return dead_instructions; }
+	inline size_t get_lowered_instruction_count() { return lowered_instructions; }
+	inline size_t get_sized_delay_count() { return sized_delays; }
+	inline size_t get_fused_instruction_count() { return fused_instructions; }
+	inline size_t get_transient_register_count() { return transient_registers; }
+
+private:
+	void find_producers();
+	Instruction* sole_producer(Register* reg);
+	Instruction* constant_producer(Register* reg);
+	std::string merge_key(Instruction* inst);
+	bool can_merge(Instruction* inst);
+	void merge(Instruction* keep, Instruction* dup);
+	bool can_fuse(Instruction* producer, Instruction* consumer, Register* reg);
+	void fuse(Instruction* producer, Instruction* consumer, size_t input);
+	bool is_live(Instruction* inst);
+	bool is_program_output(Register* reg);
+	bool is_transient(Register* reg);
+
+	Program* program;
+	std::map<Register*, std::vector<Instruction*>> producers;
+	size_t folded_instructions;
+	size_t merged_instructions;
+	size_t dead_instructions;
+	size_t lowered_instructions;
+	size_t sized_delays;
+	size_t fused_instructions;
+	size_t transient_registers;
+};
+
+};
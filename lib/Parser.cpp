@@ -52,6 +52,8 @@ int left_bind(Token* token)
 		return 0;
 	if(token->type == TokenType::Real)
 		return 0;
+	if(token->type == TokenType::Int)
+		return 0;
 	if(token->type == TokenType::String)
 		return 0;
 	if(token->type == TokenType::Lt)
@@ -91,6 +93,8 @@ std::unique_ptr<Expression> null_denotation(Lexer& lexer, std::unique_ptr<Token>
 		return std::make_unique<SymbolExpression>(std::move(token));
 	if(token->type == TokenType::Real)
 		return std::make_unique<RealExpression>(std::move(token));
+	if(token->type == TokenType::Int)
+		return std::make_unique<IntExpression>(std::move(token));
 	if(token->type == TokenType::String)
 		return std::make_unique<StringExpression>(std::move(token));
 	if(token->type == TokenType::Sub)
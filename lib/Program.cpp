@@ -5,12 +5,13 @@
 #include "llvm/IR/IRBuilder.h"
 #include "Diagnostics.h"
 #include "Parser.h"
+#include <algorithm>
 
 namespace xerxzema
 {
 Program::Program(Namespace* p, const std::string& name) : parent(p), root_name(name),
 														  is_trivial(false), valid(true),
-														  call_site(nullptr)
+														  call_site(nullptr), _block_size(0)
 {
 	reg("head");
 	reg("head")->type(p->world()->get_namespace("core")->type("unit"));
@@ -54,6 +55,57 @@ void Program::instruction(std::unique_ptr<Instruction>&& inst)
 	instructions.push_back(std::move(inst));
 }
 
+static void unlink_activations(Instruction* inst)
+{
+	for(auto& r: inst->dependencies())
+	{
+		auto& acts = r->activations;
+		acts.erase(std::remove_if(acts.begin(), acts.end(),
+								  [inst](const ActivationMask& a)
+								  { return a.instruction == inst; }),
+				   acts.end());
+	}
+}
+
+void Program::remove_instruction(Instruction* inst)
+{
+	release_instruction(inst);
+}
+
+std::unique_ptr<Instruction> Program::release_instruction(Instruction* inst)
+{
+	//unhook the activations pointing at this guy first
+	unlink_activations(inst);
+	std::unique_ptr<Instruction> result;
+	for(auto it = instructions.begin(); it != instructions.end(); it++)
+	{
+		if(it->get() == inst)
+		{
+			result = std::move(*it);
+			instructions.erase(it);
+			break;
+		}
+	}
+	return result;
+}
+
+std::unique_ptr<Instruction> Program::replace_instruction(Instruction* old_inst,
+														  std::unique_ptr<Instruction>&& inst)
+{
+	unlink_activations(old_inst);
+	std::unique_ptr<Instruction> result;
+	for(auto& i: instructions)
+	{
+		if(i.get() == old_inst)
+		{
+			result = std::move(i);
+			i = std::move(inst);
+			break;
+		}
+	}
+	return result;
+}
+
 void Program::instruction(const std::string &name,
 						  const std::vector<std::string> &inputs,
 						  const std::vector<std::string> &outputs)
@@ -165,6 +217,13 @@ bool Program::check_instruction(const std::string &name,
 			}
 			if(output_types.size() == target_outputs.size())
 			{
+				auto inst = def->create(input_types, output_types);
+				if(_block_size > 0 && inst->is_ugen())
+				{
+					//a whole block per activation, see block_size()
+					for(auto& type: output_types)
+						type = parent->type("array", {type});
+				}
 				auto it = target_outputs.begin();
 				for(auto& type: output_types)
 				{
@@ -193,7 +252,6 @@ bool Program::check_instruction(const std::string &name,
 					}
 					it++;
 				}
-				auto inst = def->create(input_types, output_types);
 				for(auto& n:inputs)
 				{
 					if(n.sample)
@@ -226,6 +284,45 @@ bool Program::check_instruction(const std::string &name,
 	return false;
 }
 
+bool Program::is_last_use(Register* reg, Instruction* consumer)
+{
+	if(std::find(inputs.begin(), inputs.end(), reg) != inputs.end() ||
+	   std::find(outputs.begin(), outputs.end(), reg) != outputs.end())
+		return false;
+
+	size_t reads = 0;
+	for(auto& inst: instructions)
+	{
+		for(auto& r: inst->inputs())
+		{
+			if(r != reg)
+				continue;
+			if(inst.get() != consumer)
+				return false;
+			reads++;
+		}
+	}
+	if(reads != 1)
+		return false;
+
+	for(auto& activate: reg->activations)
+	{
+		if(activate.instruction == consumer &&
+		   (consumer->reset_activation_mask() & activate.value))
+			return false;
+	}
+	return true;
+}
+
+//pointers and aggregates report no primitive size but need at least 8 byte alignment
+static uint64_t layout_width(Register* reg, llvm::LLVMContext& context)
+{
+	if(!reg->type())
+		return 64;
+	auto bits = reg->type()->type(context)->getPrimitiveSizeInBits();
+	return bits ? bits : 64;
+}
+
 llvm::FunctionType* Program::function_type(llvm::LLVMContext& context)
 {
 	//WHY dont' we just spin-wait for the initial version of this
@@ -239,7 +336,14 @@ llvm::FunctionType* Program::function_type(llvm::LLVMContext& context)
 	data_types.push_back(llvm::Type::getInt64Ty(context)); //time when scheduled
 	//we may want to promote the time-when-scheduled to a function argument
 	int i = 5;
-	for(auto r: locals)
+	//widest first so real32 and bool registers sit next to each other instead
+	//of each one padding out to the next real
+	std::vector<Register*> layout(locals);
+	std::stable_sort(layout.begin(), layout.end(), [&context](Register* a, Register* b)
+	{
+		return layout_width(a, context) > layout_width(b, context);
+	});
+	for(auto r: layout)
 	{
 		if(!r->type())
 		{
@@ -247,7 +351,11 @@ llvm::FunctionType* Program::function_type(llvm::LLVMContext& context)
 			return nullptr;
 		}
 
-		if(r->type()->name() != "unit")
+		if(r->is_transient())
+		{
+			r->offset(register_no_slot);
+		}
+		else if(r->type()->name() != "unit")
 		{
 			data_types.push_back(r->type()->type(context));
 			r->offset(i++);
@@ -288,16 +396,20 @@ void Program::allocate_registers(llvm::LLVMContext& context, llvm::IRBuilder<>&
 {
 	auto args = fn->arg_begin();
 	args++;
+	//everything starts out initialized, moves from the state release whatever
+	//the register held before
 	for(auto r: inputs)
 	{
 		auto value = builder.CreateAlloca(r->type()->type(context), nullptr, r->name());
 		r->value(value);
+		r->type()->init(context, builder, this, value);
 	}
 
 	for(auto r: outputs)
 	{
 		auto value = builder.CreateAlloca(r->type()->type(context), nullptr, r->name());
 		r->value(value);
+		r->type()->init(context, builder, this, value);
 	}
 
 	for(auto r: locals)
@@ -327,10 +439,11 @@ void Program::generate_exit_block(llvm::LLVMContext& context, llvm::IRBuilder<>&
 	for(auto& reg: registers)
 	{
 		auto r = reg.second.get();
-		if(r->type()->name() != "unit")
+		if(r->type()->name() != "unit" && !r->is_transient())
 		{
+			//the state slot was emptied on the way in so this is just a hand over
 			auto ptr = builder.CreateStructGEP(state_type, &*function->arg_begin(), r->offset());
-			r->type()->copy(context, builder, this, ptr, r->fetch_value_raw(context, builder));
+			r->type()->move(context, builder, this, ptr, r->fetch_value_raw(context, builder));
 		}
 	}
 	for(auto& r: instructions)
@@ -382,7 +495,7 @@ llvm::BasicBlock* Program::generate_entry_block(llvm::LLVMContext& context,
 		if(r->type()->name() != "unit")
 		{
 			ptr = builder.CreateStructGEP(state_type, &*function->arg_begin(), r->offset());
-			r->type()->copy(context, builder, this, r->fetch_value_raw(context, builder), ptr);
+			r->type()->move(context, builder, this, r->fetch_value_raw(context, builder), ptr);
 		}
 	}
 	for(auto r: outputs)
@@ -411,10 +524,10 @@ llvm::BasicBlock* Program::generate_entry_block(llvm::LLVMContext& context,
 	for(auto& reg: registers)
 	{
 		auto r = reg.second.get();
-		if(r->type()->name() != "unit")
+		if(r->type()->name() != "unit" && !r->is_transient())
 		{
 			ptr = builder.CreateStructGEP(state_type, &*function->arg_begin(), r->offset());
-			r->type()->copy(context, builder,this, r->fetch_value_raw(context, builder), ptr);
+			r->type()->move(context, builder,this, r->fetch_value_raw(context, builder), ptr);
 		}
 	}
 
@@ -580,6 +693,13 @@ void Program::code_gen(llvm::Module *module, llvm::LLVMContext &context)
 	_current_module = module;
 
 	llvm::IRBuilder<> builder(context);
+	//the real instructions pick up the namespace's float mode through the builder
+	if(parent->float_mode() == FloatMode::Fast)
+	{
+		llvm::FastMathFlags fmf;
+		fmf.setUnsafeAlgebra();
+		builder.setFastMathFlags(fmf);
+	}
 
 	program_state = &*function->arg_begin();
 
@@ -758,10 +878,22 @@ void Program::destructor_gen(llvm::Module* module, llvm::LLVMContext& context)
 	auto block = llvm::BasicBlock::Create(context, "entry", fn);
 	builder.SetInsertPoint(block);
 
+	//pending closures would run against freed state
+	bool schedules = false;
+	for(auto& inst:instructions)
+		schedules = schedules || inst->has_deferred_outputs();
+	if(schedules)
+	{
+		auto cancel = name_space()->get_external_function("cancel_state", module, context);
+		auto scheduler_var = name_space()->get_external_variable("scheduler", module, context);
+		auto state_cast = builder.CreateBitCast(state, llvm::Type::getInt8PtrTy(context));
+		builder.CreateCall(cancel, {builder.CreateLoad(scheduler_var), state_cast});
+	}
+
 	for(auto& r:registers)
 	{
 		auto reg = r.second.get();
-		if(reg->type()->name() != "unit")
+		if(reg->type()->name() != "unit" && !reg->is_transient())
 		{
 			auto site_ptr = builder.CreateStructGEP(state_type, state, reg->offset());
 			reg->type()->destroy(context, builder, this, site_ptr);
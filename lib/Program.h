@@ -38,6 +38,10 @@ public:
 	void add_input(const std::string& name, Type* type);
 	void add_output(const std::string& name, Type* type);
 	void instruction(std::unique_ptr<Instruction>&& inst);
+	void remove_instruction(Instruction* inst);
+	std::unique_ptr<Instruction> release_instruction(Instruction* inst);
+	std::unique_ptr<Instruction> replace_instruction(Instruction* old_inst,
+													 std::unique_ptr<Instruction>&& inst);
 	void instruction(const std::string& name,
 					 const std::vector<std::string>& inputs,
 					 const std::vector<std::string>& outputs);
@@ -73,6 +77,7 @@ public:
 	inline std::string program_name() { return root_name; }
 	inline std::vector<Register*>& input_registers() { return inputs; }
 	inline std::vector<Register*>& output_registers() { return outputs; }
+	inline std::vector<Register*>& local_registers() { return locals; }
 
 	inline const std::vector<std::unique_ptr<Instruction>>& instruction_listing()
 	{
@@ -84,10 +89,21 @@ public:
 		return registers;
 	}
 
+	//consumer is the only instruction that reads reg and it only ever sees fresh
+	//values (no sampling), so it can take the value with Type::move instead of
+	//sharing it. the register stays empty until its producer writes it again.
+	bool is_last_use(Register* reg, Instruction* consumer);
+
 	std::string symbol_name();
 	llvm::Value* create_closure(Register* reg, bool reinvoke,
 								llvm::LLVMContext& context, llvm::Module* module);
 	inline bool is_valid() const { return valid; }
+	//number of samples a ugen produces per activation, 0 runs them a sample at a time.
+	//ugens in a block rate program write array blocks instead of scalars so the
+	//dispatch and activation checks are paid once per block.
+	inline uint32_t block_size() const { return _block_size; }
+	inline void block_size(uint32_t n) { _block_size = n; }
+	static const uint32_t default_block_size = 64;
 	inline llvm::GlobalVariable* get_call_site() { return call_site; }
 	llvm::Function* create_declaration(llvm::Module* module, llvm::LLVMContext& context);
 	llvm::Function* create_dtor_declaration(llvm::Module* module, llvm::LLVMContext& context);
@@ -128,6 +144,7 @@ private:
 	bool is_trivial;
 	llvm::Value* program_state;
 	bool valid;
+	uint32_t _block_size;
 };
 
 
@@ -1,9 +1,13 @@
 #include <stdio.h>
 #include <stdarg.h>
+#include <stdlib.h>
 
 #include "RT.h"
 
 #include "Scheduler.h"
+#include "ArrayKernels.h"
+#include "ArrayStorage.h"
+#include "TraceLog.h"
 
 using namespace xerxzema;
 
@@ -15,8 +19,118 @@ void xerxzema_print(const char* fmt, ...)
 	va_end(args);
 }
 
-void xerxzema_schedule(void* scheduler, void(*fn)(void*), void* state, uint64_t when)
+void xerxzema_trace_real(int64_t site, double value)
+{
+	trace_log()->trace_real(site, value);
+}
+
+void xerxzema_trace_string(int64_t site, const char* data, int64_t size)
+{
+	trace_log()->trace_string(site, data, size);
+}
+
+//lock free through the calling thread's buffer unless the queue is bounded,
+//see Scheduler::submit_local. the ScheduleStatus, negative when the task was
+//rejected and positive when the overload policy had to step in
+int64_t xerxzema_schedule(void* scheduler, void(*fn)(void*), void* state, uint64_t when)
+{
+	auto s = (Scheduler*)scheduler;
+	return (int64_t)s->submit_local(fn, state, when);
+}
+
+//for io drivers handing input to a program closure, same as xerxzema_schedule
+//but on the realtime lane so it runs ahead of timers due in the same window
+int64_t xerxzema_schedule_realtime(void* scheduler, void(*fn)(void*), void* state, uint64_t when)
+{
+	auto s = (Scheduler*)scheduler;
+	return (int64_t)s->submit_local(fn, state, when, SchedulerLane::Realtime);
+}
+
+void xerxzema_cancel_state(void* scheduler, void* state)
+{
+	auto s = (Scheduler*)scheduler;
+	s->cancel_state(state);
+}
+
+//the first tick is one period after the run that armed it so the ticks stay on
+//the same grid however late that run was dispatched. a program that wasn't
+//started by the scheduler has no exec_time and arms from now.
+void xerxzema_schedule_periodic(void* scheduler, void(*fn)(void*), void* state,
+								uint64_t exec_time, uint64_t period)
 {
 	auto s = (Scheduler*)scheduler;
-	s->schedule(fn, state, when);
+	auto start = exec_time ? exec_time : s->time();
+	s->schedule_periodic(fn, state, start + period, period);
+}
+
+double xerxzema_array_sum(const double* data, int64_t size)
+{
+	return array_sum(data, size);
+}
+
+double xerxzema_array_dot(const double* lhs, const double* rhs, int64_t size)
+{
+	return array_dot(lhs, rhs, size);
+}
+
+double xerxzema_array_min(const double* data, int64_t size)
+{
+	return array_min(data, size);
+}
+
+double xerxzema_array_max(const double* data, int64_t size)
+{
+	return array_max(data, size);
+}
+
+double xerxzema_array_mean(const double* data, int64_t size)
+{
+	return array_mean(data, size);
+}
+
+void* xerxzema_array_reserve(void* array, int64_t size, int64_t element_size)
+{
+	return array_reserve((ArrayValue*)array, size, element_size);
+}
+
+void xerxzema_array_retain(void* array)
+{
+	array_retain((ArrayValue*)array);
+}
+
+void xerxzema_array_release(void* array)
+{
+	array_release((ArrayValue*)array);
+}
+
+//state of a DelayLine instruction
+struct DelayLine
+{
+	double* data;
+	int64_t mask;
+	int64_t position;
+};
+
+//resizes the ring to the next power of two above length. the samples the old ring
+//still held keep their distance from the write position, older ones read as 0.
+//a failed allocation keeps the old ring, the delay reads the oldest tap it has
+//until a later grow succeeds.
+void xerxzema_delay_grow(void* line, int64_t length)
+{
+	auto delay = (DelayLine*)line;
+	int64_t capacity = 16;
+	while(capacity <= length)
+		capacity <<= 1;
+	auto data = (double*)calloc(capacity, sizeof(double));
+	if(!data)
+		return;
+	auto mask = capacity - 1;
+	if(delay->data)
+	{
+		for(int64_t k = 1; k <= delay->mask + 1; k++)
+			data[(delay->position - k) & mask] = delay->data[(delay->position - k) & delay->mask];
+		free(delay->data);
+	}
+	delay->data = data;
+	delay->mask = mask;
 }
@@ -6,7 +6,22 @@
 extern "C" {
 
 void xerxzema_print(const char* fmt, ...);
-void xerxzema_schedule(void* scheduler, void(*fn)(void*), void* state, uint64_t when);
+void xerxzema_trace_real(int64_t site, double value);
+void xerxzema_trace_string(int64_t site, const char* data, int64_t size);
+int64_t xerxzema_schedule(void* scheduler, void(*fn)(void*), void* state, uint64_t when);
+int64_t xerxzema_schedule_realtime(void* scheduler, void(*fn)(void*), void* state, uint64_t when);
+void xerxzema_cancel_state(void* scheduler, void* state);
+void xerxzema_schedule_periodic(void* scheduler, void(*fn)(void*), void* state,
+								uint64_t exec_time, uint64_t period);
+double xerxzema_array_sum(const double* data, int64_t size);
+double xerxzema_array_dot(const double* lhs, const double* rhs, int64_t size);
+double xerxzema_array_min(const double* data, int64_t size);
+double xerxzema_array_max(const double* data, int64_t size);
+double xerxzema_array_mean(const double* data, int64_t size);
+void xerxzema_delay_grow(void* line, int64_t length);
+void* xerxzema_array_reserve(void* array, int64_t size, int64_t element_size);
+void xerxzema_array_retain(void* array);
+void xerxzema_array_release(void* array);
 
 
 };
@@ -4,7 +4,8 @@
 namespace xerxzema
 {
 
-Register::Register(const std::string& name) : _name(name), _type(nullptr), state_offset(0)
+Register::Register(const std::string& name) : _name(name), _type(nullptr), state_offset(register_no_slot),
+											 _transient(false)
 {
 
 }
@@ -12,6 +12,10 @@ namespace xerxzema
 class Instruction;
 struct DeferredInstruction;
 
+//offset of registers without a slot in the program state (transient and unit
+//registers). 0 is a real field, the reentry flag.
+static const uint32_t register_no_slot = UINT32_MAX;
+
 struct ActivationMask
 {
 	Instruction* instruction;
@@ -27,8 +31,13 @@ public:
 	void type(Type* t);
 	void offset(uint32_t o);
 	inline uint32_t offset() { return state_offset; }
+	inline bool has_slot() const { return state_offset != register_no_slot; }
 
 	inline bool is_inferred() const { return type() != nullptr; }
+	//transient registers only live for a single activation so they never get
+	//a slot in the program state.
+	inline bool is_transient() const { return _transient; }
+	inline void transient(bool t) { _transient = t; }
 	inline const std::string& name() const { return _name; }
 
 	inline void value(llvm::Value* val) { _value = val; }
@@ -49,6 +58,7 @@ private:
 	std::string _name;
 	Type* _type;
 	uint32_t state_offset;
+	bool _transient;
 };
 
 };
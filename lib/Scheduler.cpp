@@ -1,9 +1,20 @@
 #include "Scheduler.h"
 #include "Diagnostics.h"
+#include "EventRecorder.h"
 #include <time.h>
 #include <stdio.h>
 #include <algorithm>
 #include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <alloca.h>
+#include <string.h>
+#include <errno.h>
+#include <chrono>
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#endif
 
 namespace xerxzema
 {
@@ -45,15 +56,652 @@ uint64_t now()
 	return stamp;
 }
 
-Scheduler::Scheduler() : exit_if_empty(false)
+SchedulerMetrics::SchedulerMetrics()
 {
+	reset();
+}
+
+void SchedulerMetrics::reset()
+{
+	lateness.reset();
+	execution.reset();
+	queue_depth.reset();
+	sleep_overshoot.reset();
+	total_events.store(0);
+	late_events.store(0);
+	sleep_skips.store(0);
+	overruns.store(0);
+	rejected.store(0);
+	dropped.store(0);
+	coalesced.store(0);
+	pressure.store(0);
+	for(auto& lane: lanes)
+	{
+		lane.lateness.reset();
+		lane.queue_depth.reset();
+	}
+}
+
+void SchedulerMetrics::dump(FILE* file)
+{
+	fprintf(file, "events %llu late %llu sleep skips %llu\n",
+			(unsigned long long)total_events.load(), (unsigned long long)late_events.load(),
+			(unsigned long long)sleep_skips.load());
+	fprintf(file, "rejected %llu dropped %llu coalesced %llu pressure %llu overruns %llu\n",
+			(unsigned long long)rejected.load(), (unsigned long long)dropped.load(),
+			(unsigned long long)coalesced.load(), (unsigned long long)pressure.load(),
+			(unsigned long long)overruns.load());
+	lateness.dump(file, "lateness");
+	execution.dump(file, "execution");
+	queue_depth.dump(file, "queue depth");
+	sleep_overshoot.dump(file, "sleep overshoot");
+	const char* names[] = {"realtime", "timer", "background"};
+	for(size_t i = 0; i < scheduler_lanes; i++)
+	{
+		lanes[i].lateness.dump(file, std::string(names[i]) + " lateness");
+		lanes[i].queue_depth.dump(file, std::string(names[i]) + " queue depth");
+	}
+}
+
+SchedulerConfig::SchedulerConfig() : cpu(-1), fifo_priority(0), lock_memory(false),
+									 prefault(false), prefault_stack(0), flush_denormals(false),
+									 program_budget(0), watchdog(0)
+{
+}
+
+void prefault(void* memory, size_t size, bool writable)
+{
+	static const size_t page = sysconf(_SC_PAGESIZE);
+	auto bytes = (volatile char*)memory;
+	for(size_t i = 0; i < size; i += page)
+	{
+		char value = bytes[i];
+		if(writable)
+			bytes[i] = value;
+	}
+	if(size)
+	{
+		char value = bytes[size - 1];
+		if(writable)
+			bytes[size - 1] = value;
+	}
+}
+
+//every scheduler gets its own id so a thread's cached buffer can't outlive its scheduler
+static std::atomic<uint64_t> next_scheduler_id(1);
+static thread_local uint64_t cached_scheduler = 0;
+static thread_local ProducerBuffer* cached_producer = nullptr;
+
+Scheduler::Scheduler() : policy(LanePolicy::Strict), _capacity(0), high_water(0),
+						 overload(OverloadPolicy::Reject), recorder(nullptr),
+						 exit_if_empty(false), offline_mode(false), offline_until(0),
+						 id(next_scheduler_id.fetch_add(1)), demote_streak(0),
+						 dispatch_budget(nullptr), saved_float_control(0)
+{
+	producer_count.store(0);
+	has_budgets.store(false);
+	dispatch_start.store(0);
+	dispatch_state.store(nullptr);
+	watching.store(false);
+	virtual_time.store(0);
 	running.store(true);
+	const uint32_t default_weights[] = {8, 4, 1};
+	for(size_t i = 0; i < scheduler_lanes; i++)
+	{
+		live[i] = 0;
+		weights[i] = default_weights[i];
+		credits[i] = default_weights[i];
+	}
+}
+
+//sets flush-to-zero and denormals-are-zero for the calling thread and returns
+//the old control word for restore_float_control.
+//decaying filters and envelopes otherwise spend a long time crawling
+//through denormals which can be 100x slower on x86.
+static uint64_t set_denormals_zero()
+{
+#if defined(__SSE__)
+	auto csr = _mm_getcsr();
+	_mm_setcsr(csr | 0x8040);
+	return csr;
+#elif defined(__aarch64__)
+	uint64_t fpcr;
+	asm volatile("mrs %0, fpcr" : "=r"(fpcr));
+	asm volatile("msr fpcr, %0" : : "r"(fpcr | (1 << 24)));
+	return fpcr;
+#else
+	return 0;
+#endif
+}
+
+static void restore_float_control(uint64_t control)
+{
+#if defined(__SSE__)
+	_mm_setcsr(control);
+#elif defined(__aarch64__)
+	asm volatile("msr fpcr, %0" : : "r"(control));
+#endif
+}
+
+void Scheduler::configure(const SchedulerConfig& config)
+{
+	_config = config;
+}
+
+static void warn_errno(const std::string& what, int error)
+{
+	emit_warn("scheduler: " + what + " failed, " + strerror(error));
+}
+
+void Scheduler::apply_config()
+{
+	if(_config.cpu >= 0)
+	{
+		pthread_getaffinity_np(pthread_self(), sizeof(saved_cpus), &saved_cpus);
+		cpu_set_t cpus;
+		CPU_ZERO(&cpus);
+		CPU_SET(_config.cpu, &cpus);
+		auto error = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+		if(error)
+			warn_errno("pinning to cpu " + std::to_string(_config.cpu), error);
+	}
+
+	if(_config.fifo_priority > 0)
+	{
+		pthread_getschedparam(pthread_self(), &saved_policy, &saved_param);
+		sched_param param;
+		param.sched_priority = std::min(_config.fifo_priority, sched_get_priority_max(SCHED_FIFO));
+		auto error = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+		if(error)
+			warn_errno("SCHED_FIFO", error);
+	}
+
+	if(_config.flush_denormals)
+		saved_float_control = set_denormals_zero();
+
+	//future pages too, so the state and code of programs compiled later are locked
+	if(_config.lock_memory && mlockall(MCL_CURRENT | MCL_FUTURE))
+		warn_errno("mlockall", errno);
+
+	if(_config.prefault_stack)
+	{
+		auto stack = alloca(_config.prefault_stack);
+		prefault(stack, _config.prefault_stack, true);
+	}
+}
+
+ProducerBuffer::ProducerBuffer(std::thread::id owner) : _owner(owner)
+{
+	write.store(0);
+	read.store(0);
+}
+
+bool ProducerBuffer::push(const PendingTask& task)
+{
+	auto head = write.load(std::memory_order_relaxed);
+	if(head - read.load(std::memory_order_acquire) == producer_capacity)
+		return false;
+	tasks[head & (producer_capacity - 1)] = task;
+	write.store(head + 1, std::memory_order_release);
+	return true;
+}
+
+//only the first submit_local on a thread takes a lock
+ProducerBuffer* Scheduler::producer()
+{
+	if(cached_scheduler == id)
+		return cached_producer;
+
+	std::lock_guard<std::mutex> guard(producer_lock);
+	auto self = std::this_thread::get_id();
+	auto count = producer_count.load(std::memory_order_relaxed);
+	ProducerBuffer* found = nullptr;
+	for(size_t i = 0; i < count; i++)
+	{
+		if(producers[i]->owner() == self)
+			found = producers[i].get();
+	}
+	if(!found && count < max_producers)
+	{
+		producers[count] = std::make_unique<ProducerBuffer>(self);
+		found = producers[count].get();
+		producer_count.store(count + 1, std::memory_order_release);
+	}
+	cached_scheduler = id;
+	cached_producer = found;
+	return found;
+}
+
+ScheduleStatus Scheduler::submit_local(scheduler_callback callback, void* state, uint64_t when,
+									   SchedulerLane lane)
+{
+	//a bounded queue has to run the overload policy before the producer gets
+	//its status, that needs the task lock
+	if(_capacity.load(std::memory_order_relaxed))
+		return submit(callback, state, when, 0, lane);
+	auto buffer = producer();
+	PendingTask pending{CallbackData{(CallbackState*)state, callback, when, 0, 0, 0, lane},
+						time()};
+	if(!buffer || !buffer->push(pending))
+		return push_task(pending.task, nullptr);
+	return ScheduleStatus::Queued;
+}
+
+void Scheduler::merge_pending()
+{
+	auto count = producer_count.load(std::memory_order_acquire);
+	for(size_t i = 0; i < count; i++)
+	{
+		producers[i]->drain([this](const PendingTask& pending)
+		{
+			insert(pending.task, nullptr, pending.enqueued);
+		});
+	}
 }
 
-void Scheduler::schedule(scheduler_callback callback, void* state, uint64_t when)
+ScheduleStatus Scheduler::push_task(CallbackData task, scheduler_handle* handle)
 {
 	std::lock_guard<std::mutex> guard(task_lock);
-	tasks.push(CallbackData{(CallbackState*)state, callback, when});
+	//anything submitted lock free before this goes in first
+	merge_pending();
+	return insert(task, handle, time());
+}
+
+ScheduleStatus Scheduler::insert(CallbackData task, scheduler_handle* handle, uint64_t enqueued)
+{
+	if(handle)
+		*handle = 0;
+	if(recorder)
+		recorder->record(task, enqueued);
+	if(has_budgets.load(std::memory_order_relaxed) && is_demoted(task.state))
+		task.lane = SchedulerLane::Background;
+	auto status = ScheduleStatus::Queued;
+	if(_capacity && queued() >= _capacity)
+	{
+		status = overflow(task, handle);
+		if(status != ScheduleStatus::Dropped)
+			return status;
+	}
+
+	if(free_slots.size())
+	{
+		task.slot = free_slots.back();
+		free_slots.pop_back();
+		slot_lanes[task.slot] = task.lane;
+	}
+	else
+	{
+		task.slot = generations.size();
+		generations.push_back(1);
+		slot_lanes.push_back(task.lane);
+	}
+	task.generation = generations[task.slot];
+	auto& heap = tasks[(size_t)task.lane];
+	heap.push_back(task);
+	std::push_heap(heap.begin(), heap.end(), std::greater<CallbackData>());
+	live[(size_t)task.lane]++;
+
+	if(status == ScheduleStatus::Queued && _capacity && queued() > high_water)
+	{
+		status = ScheduleStatus::Pressure;
+		_metrics.pressure.fetch_add(1, std::memory_order_relaxed);
+	}
+	if(handle)
+		*handle = ((uint64_t)task.generation << 32) | task.slot;
+	return status;
+}
+
+ScheduleStatus Scheduler::overflow(const CallbackData& task, scheduler_handle* handle)
+{
+	switch(overload)
+	{
+	case OverloadPolicy::Reject:
+		break;
+	case OverloadPolicy::DropOldest:
+	{
+		int oldest = -1;
+		for(size_t i = 0; i < scheduler_lanes; i++)
+		{
+			drop_dead(tasks[i]);
+			if(tasks[i].size() && (oldest < 0 || tasks[i].front() < tasks[oldest].front()))
+				oldest = i;
+		}
+		if(oldest < 0)
+			break;
+		release_slot(tasks[oldest].front().slot);
+		_metrics.dropped.fetch_add(1, std::memory_order_relaxed);
+		return ScheduleStatus::Dropped;
+	}
+	case OverloadPolicy::DropLowest:
+		for(int i = scheduler_lanes - 1; i >= (int)task.lane; i--)
+		{
+			drop_dead(tasks[i]);
+			if(!tasks[i].size())
+				continue;
+			release_slot(tasks[i].front().slot);
+			_metrics.dropped.fetch_add(1, std::memory_order_relaxed);
+			return ScheduleStatus::Dropped;
+		}
+		break;
+	case OverloadPolicy::Coalesce:
+	{
+		auto& heap = tasks[(size_t)task.lane];
+		for(auto& other: heap)
+		{
+			if(!is_live(other) || other.state != task.state || other.fn != task.fn ||
+			   other.period != task.period)
+				continue;
+			//the merged task runs at the earlier of the two deadlines
+			if(task.when < other.when)
+			{
+				other.when = task.when;
+				std::make_heap(heap.begin(), heap.end(), std::greater<CallbackData>());
+			}
+			if(handle)
+				*handle = ((uint64_t)other.generation << 32) | other.slot;
+			_metrics.coalesced.fetch_add(1, std::memory_order_relaxed);
+			return ScheduleStatus::Coalesced;
+		}
+		break;
+	}
+	}
+	_metrics.rejected.fetch_add(1, std::memory_order_relaxed);
+	return ScheduleStatus::Rejected;
+}
+
+ScheduleStatus Scheduler::submit(scheduler_callback callback, void* state, uint64_t when,
+								 uint64_t period, SchedulerLane lane, scheduler_handle* handle)
+{
+	return push_task(CallbackData{(CallbackState*)state, callback, when, period, 0, 0, lane},
+					 handle);
+}
+
+scheduler_handle Scheduler::schedule(scheduler_callback callback, void* state, uint64_t when,
+									 SchedulerLane lane)
+{
+	scheduler_handle handle;
+	submit(callback, state, when, 0, lane, &handle);
+	return handle;
+}
+
+scheduler_handle Scheduler::schedule_periodic(scheduler_callback callback, void* state,
+											  uint64_t first, uint64_t period,
+											  SchedulerLane lane)
+{
+	scheduler_handle handle;
+	submit(callback, state, first, period, lane, &handle);
+	return handle;
+}
+
+void Scheduler::capacity(size_t tasks, OverloadPolicy policy, uint32_t high)
+{
+	std::lock_guard<std::mutex> guard(task_lock);
+	_capacity = tasks;
+	high_water = tasks * std::min<uint32_t>(high, 100) / 100;
+	overload = policy;
+}
+
+void Scheduler::record(EventRecorder* r)
+{
+	std::lock_guard<std::mutex> guard(task_lock);
+	recorder = r;
+}
+
+void Scheduler::budget(void* state, const std::string& name, uint64_t budget)
+{
+	std::lock_guard<std::mutex> guard(task_lock);
+	//a budget given again starts over in place, the run loop may hold the old one
+	auto& b = _budgets[state];
+	if(!b)
+		b = std::make_unique<BudgetCounters>();
+	b->name = name;
+	b->budget.store(budget);
+	b->runs.store(0);
+	b->overruns.store(0);
+	b->streak.store(0);
+	b->worst.store(0);
+	b->demoted.store(false);
+	has_budgets.store(true);
+}
+
+void Scheduler::demote_after(uint32_t overruns)
+{
+	std::lock_guard<std::mutex> guard(task_lock);
+	demote_streak = overruns;
+}
+
+std::vector<ProgramBudget> Scheduler::budgets()
+{
+	std::lock_guard<std::mutex> guard(task_lock);
+	std::vector<ProgramBudget> copy;
+	for(auto& entry: _budgets)
+	{
+		auto& b = *entry.second;
+		copy.push_back(ProgramBudget{b.name, b.budget.load(), b.runs.load(), b.overruns.load(),
+									 b.streak.load(), b.worst.load(), b.demoted.load()});
+	}
+	return copy;
+}
+
+void Scheduler::report_budgets(FILE* file)
+{
+	auto all = budgets();
+	std::sort(all.begin(), all.end(), [](const ProgramBudget& lhs, const ProgramBudget& rhs)
+	{
+		return lhs.overruns > rhs.overruns;
+	});
+	for(auto& b: all)
+	{
+		fprintf(file, "%s: budget %lluus runs %llu overruns %llu worst %lluus%s\n",
+				b.name.c_str(), (unsigned long long)b.budget / 1000,
+				(unsigned long long)b.runs, (unsigned long long)b.overruns,
+				(unsigned long long)b.worst / 1000, b.demoted ? " (demoted)" : "");
+	}
+}
+
+static std::string microseconds(uint64_t ns)
+{
+	return std::to_string(ns / 1000) + "us";
+}
+
+void Scheduler::check_budget(BudgetCounters* b, void* state, uint64_t elapsed)
+{
+	b->runs.fetch_add(1, std::memory_order_relaxed);
+	auto budget = b->budget.load(std::memory_order_relaxed);
+	if(elapsed <= budget)
+	{
+		b->streak.store(0, std::memory_order_relaxed);
+		return;
+	}
+	auto overruns = b->overruns.fetch_add(1, std::memory_order_relaxed) + 1;
+	auto streak = b->streak.fetch_add(1, std::memory_order_relaxed) + 1;
+	if(elapsed > b->worst.load(std::memory_order_relaxed))
+		b->worst.store(elapsed, std::memory_order_relaxed);
+	_metrics.overruns.fetch_add(1, std::memory_order_relaxed);
+
+	//only the first overrun and a demotion are reported as they happen,
+	//report_budgets has the rest
+	auto after = demote_streak.load(std::memory_order_relaxed);
+	bool demoting = after && streak >= after && !b->demoted.load(std::memory_order_relaxed);
+	if(overruns != 1 && !demoting)
+		return;
+
+	std::string report;
+	{
+		std::lock_guard<std::mutex> guard(task_lock);
+		if(overruns == 1)
+			report = b->name + " took " + microseconds(elapsed) + ", its budget is " +
+				microseconds(budget);
+		if(demoting)
+		{
+			b->demoted.store(true, std::memory_order_relaxed);
+			demote(state);
+			report = b->name + " overran its budget " + std::to_string(streak) +
+				" times in a row, moving it to the background lane";
+		}
+	}
+	emit_warn(report);
+}
+
+bool Scheduler::is_demoted(void* state)
+{
+	auto found = _budgets.find(state);
+	return found != _budgets.end() && found->second->demoted.load(std::memory_order_relaxed);
+}
+
+void Scheduler::demote(void* state)
+{
+	auto background = (size_t)SchedulerLane::Background;
+	auto& target = tasks[background];
+	for(size_t i = 0; i < background; i++)
+	{
+		auto& heap = tasks[i];
+		auto moved = std::partition(heap.begin(), heap.end(), [this, state](const CallbackData& t)
+		{
+			return t.state != state || !is_live(t);
+		});
+		for(auto task = moved; task != heap.end(); task++)
+		{
+			task->lane = SchedulerLane::Background;
+			slot_lanes[task->slot] = SchedulerLane::Background;
+			live[i]--;
+			live[background]++;
+			target.push_back(*task);
+			std::push_heap(target.begin(), target.end(), std::greater<CallbackData>());
+		}
+		heap.erase(moved, heap.end());
+		std::make_heap(heap.begin(), heap.end(), std::greater<CallbackData>());
+	}
+}
+
+//undoes what apply_config did to the thread, run may have been called on a
+//thread that goes on to do other work
+void Scheduler::restore_config()
+{
+	if(_config.cpu >= 0)
+		pthread_setaffinity_np(pthread_self(), sizeof(saved_cpus), &saved_cpus);
+	if(_config.fifo_priority > 0)
+		pthread_setschedparam(pthread_self(), saved_policy, &saved_param);
+	if(_config.flush_denormals)
+		restore_float_control(saved_float_control);
+}
+
+void Scheduler::start_watchdog()
+{
+	if(!_config.watchdog)
+		return;
+	watching.store(true);
+	watchdog_thread = std::thread(&Scheduler::watchdog_loop, this);
+}
+
+void Scheduler::stop_watchdog()
+{
+	watching.store(false);
+	if(watchdog_thread.joinable())
+		watchdog_thread.join();
+}
+
+//callbacks can't be interrupted, this only makes a stall visible while it happens
+void Scheduler::watchdog_loop()
+{
+	auto limit = _config.watchdog;
+	auto period = std::chrono::nanoseconds(std::max<uint64_t>(limit / 4, 10000));
+	uint64_t reported = 0;
+	while(watching.load())
+	{
+		std::this_thread::sleep_for(period);
+		auto start = dispatch_start.load(std::memory_order_acquire);
+		auto current = now();
+		if(!start || start == reported || current < start + limit)
+			continue;
+		reported = start;
+
+		std::string name = "a program without a budget";
+		{
+			std::lock_guard<std::mutex> guard(task_lock);
+			auto found = _budgets.find(dispatch_state.load(std::memory_order_relaxed));
+			if(found != _budgets.end())
+				name = found->second->name;
+		}
+		emit_warn(name + " has been running for " + microseconds(current - start) +
+				  ", the scheduler is stalled");
+	}
+}
+
+void Scheduler::dispatch(const CallbackData& task, uint64_t& start, uint64_t& end)
+{
+	//callbacks see the time they were scheduled for, not when they got to run
+	task.state->exec_time = task.when;
+	start = now();
+	dispatch_state.store(task.state, std::memory_order_relaxed);
+	dispatch_start.store(start, std::memory_order_release);
+	(*task.fn)(task.state);
+	end = now();
+	dispatch_start.store(0, std::memory_order_relaxed);
+
+	_metrics.execution.record(end - start);
+	_metrics.total_events.fetch_add(1, std::memory_order_relaxed);
+	if(dispatch_budget)
+		check_budget(dispatch_budget, task.state, end - start);
+}
+
+void Scheduler::lane_policy(LanePolicy p)
+{
+	std::lock_guard<std::mutex> guard(task_lock);
+	policy = p;
+}
+
+void Scheduler::lane_weight(SchedulerLane lane, uint32_t weight)
+{
+	std::lock_guard<std::mutex> guard(task_lock);
+	weights[(size_t)lane] = std::max<uint32_t>(weight, 1);
+}
+
+void Scheduler::release_slot(uint32_t slot)
+{
+	generations[slot]++;
+	//skip 0 so a wrapped generation can't make a 0 handle valid
+	if(!generations[slot])
+		generations[slot]++;
+	free_slots.push_back(slot);
+	live[(size_t)slot_lanes[slot]]--;
+}
+
+bool Scheduler::cancel(scheduler_handle handle)
+{
+	std::lock_guard<std::mutex> guard(task_lock);
+	uint32_t slot = handle;
+	uint32_t generation = handle >> 32;
+	if(slot >= generations.size() || generations[slot] != generation)
+		return false;
+	release_slot(slot);
+	return true;
+}
+
+void Scheduler::cancel_state(void* state)
+{
+	std::lock_guard<std::mutex> guard(task_lock);
+	merge_pending();
+	//the state is about to be freed and its address reused
+	_budgets.erase(state);
+	has_budgets.store(_budgets.size() > 0);
+	for(auto& heap: tasks)
+	{
+		for(auto& task: heap)
+		{
+			if(task.state == state && is_live(task))
+				release_slot(task.slot);
+		}
+	}
+}
+
+void Scheduler::drop_dead(std::vector<CallbackData>& heap)
+{
+	while(heap.size() && !is_live(heap.front()))
+	{
+		std::pop_heap(heap.begin(), heap.end(), std::greater<CallbackData>());
+		heap.pop_back();
+	}
 }
 
 static void scheduler_entry(Scheduler* s)
@@ -80,15 +728,76 @@ void Scheduler::wait()
 size_t Scheduler::task_count()
 {
 	std::lock_guard<std::mutex> guard(task_lock);
-	return tasks.size();
+	merge_pending();
+	return queued();
+}
+
+size_t Scheduler::task_count(SchedulerLane lane)
+{
+	std::lock_guard<std::mutex> guard(task_lock);
+	merge_pending();
+	return live[(size_t)lane];
+}
+
+void Scheduler::begin_window()
+{
+	std::lock_guard<std::mutex> guard(task_lock);
+	std::copy(weights, weights + scheduler_lanes, credits);
+}
+
+//-1 when nothing is due
+int Scheduler::pick_lane(uint64_t before)
+{
+	int due = -1;
+	for(size_t i = 0; i < scheduler_lanes; i++)
+	{
+		drop_dead(tasks[i]);
+		if(!tasks[i].size() || tasks[i].front().when >= before)
+			continue;
+		if(policy == LanePolicy::Strict || credits[i])
+			return i;
+		if(due < 0)
+			due = i;
+	}
+	//every lane with work has used its share, start the next round
+	if(due >= 0)
+		std::copy(weights, weights + scheduler_lanes, credits);
+	return due;
 }
 
-CallbackData Scheduler::pop_task()
+bool Scheduler::pop_task(uint64_t before, CallbackData& task)
 {
 	std::lock_guard<std::mutex> guard(task_lock);
-	auto cb = tasks.top();
-	tasks.pop();
-	return cb;
+	merge_pending();
+	auto lane = pick_lane(before);
+	if(lane < 0)
+		return false;
+	if(credits[lane])
+		credits[lane]--;
+
+	auto& heap = tasks[lane];
+	std::pop_heap(heap.begin(), heap.end(), std::greater<CallbackData>());
+	task = heap.back();
+	//looked up here since we already hold the lock, check_budget doesn't need it
+	dispatch_budget = nullptr;
+	if(has_budgets.load(std::memory_order_relaxed))
+	{
+		auto found = _budgets.find(task.state);
+		if(found != _budgets.end())
+			dispatch_budget = found->second.get();
+	}
+	if(task.period)
+	{
+		//re-arm in the slot we just vacated, no allocation or second lock
+		heap.back().when += task.period;
+		std::push_heap(heap.begin(), heap.end(), std::greater<CallbackData>());
+	}
+	else
+	{
+		heap.pop_back();
+		release_slot(task.slot);
+	}
+	return true;
 }
 
 /* uint64_t Scheduler::now()
@@ -102,106 +811,129 @@ one for seconds and one for nano-seconds and use that as a feeder/loader
 into all the time calls...
 }*/
 
-const CallbackData* Scheduler::peek_task()
+bool Scheduler::next_when(uint64_t& when, QueueDepth* depth)
 {
 	std::lock_guard<std::mutex> guard(task_lock);
-	if(!tasks.size())
-		return nullptr;
-	else
-		return &tasks.top();
+	merge_pending();
+	if(depth)
+	{
+		depth->total = queued();
+		for(size_t i = 0; i < scheduler_lanes; i++)
+			depth->lanes[i] = live[i];
+	}
+	bool found = false;
+	for(auto& heap: tasks)
+	{
+		drop_dead(heap);
+		if(heap.size() && (!found || heap.front().when < when))
+		{
+			when = heap.front().when;
+			found = true;
+		}
+	}
+	return found;
+}
+
+void Scheduler::offline(uint64_t until)
+{
+	offline_mode = true;
+	offline_until = until;
 }
+
+uint64_t Scheduler::time()
+{
+	return offline_mode ? virtual_time.load(std::memory_order_relaxed) : now();
+}
+
+//no sleeping and no windows, every deadline is a dispatch of its own so the
+//order only depends on when and lane
+void Scheduler::run_offline()
+{
+	apply_config();
+	start_watchdog();
+	CallbackData task;
+	uint64_t next = 0;
+	uint64_t task_start = 0;
+	uint64_t task_end = 0;
+
+	while(running.load() && next_when(next) && next <= offline_until)
+	{
+		virtual_time.store(std::max(next, virtual_time.load()), std::memory_order_relaxed);
+		begin_window();
+		while(running.load() && pop_task(next + 1, task))
+			dispatch(task, task_start, task_end);
+	}
+	stop_watchdog();
+	restore_config();
+}
+
+//tasks due within this much of now run in the same dispatch window
+static const uint64_t step_size = 100000;
+
 void Scheduler::run()
 {
-	//TODO clean this up a bit so we don't have global begins and goofy names...
-	struct timespec begin;
-	struct timespec next;
 	struct timespec remaining;
 	struct timespec short_sleep = {0,1};
 
-	uint64_t current = 0;
-	uint64_t sys_current = 0;
-	uint64_t last_sys_current = 0;
-	uint64_t step_size = 100000;
+	if(offline_mode)
+	{
+		run_offline();
+		return;
+	}
 
+	apply_config();
 	uint64_t max_sleep = calibrate_nanosleep();
 
 	start_clock();
+	start_watchdog();
 
 	uint64_t task_start = 0;
-
-	uint64_t sleep_skip = 0;
-	uint64_t late_events = 0;
-
-	uint64_t total_events = 0;
-	double late_total = 0;
+	uint64_t task_end = 0;
 
 	while(running.load())
 	{
-		if(!task_count() && exit_if_empty)
+		if(exit_if_empty && !task_count())
 			break;
-		//in here we call now() and get the authoritative time
-		//if now() hasn't changed since last now()
-		//we fall back to clock_gettime to calculate roughly
-		//where in the timesync window we actually are.
-		sys_current = now();
-		if(sys_current > last_sys_current)
-		{
-			current = sys_current;
-			last_sys_current = sys_current;
-			clock_gettime(CLOCK_REALTIME, &begin);
-		}
-		else
-		{
-			clock_gettime(CLOCK_REALTIME, &next);
-			auto d = diff(begin, next);
-			current = sys_current;
-			current += d.tv_sec * 1000000000;
-			current += d.tv_nsec;
-		}
 
-		const CallbackData* next_task;
-		while((next_task = peek_task()) && next_task->when < current + step_size)
+		uint64_t current = now();
+		CallbackData task;
+		begin_window();
+		while(running.load() && pop_task(current + step_size, task))
 		{
-			auto task = pop_task();
-			task.state->exec_time = task_start;
-			(*task.fn)(task.state);
-			total_events++;
-			if(current > task_start && current - task_start > step_size)
-			{
-				late_events++;
-				late_total += current - task.when;
-			}
+			dispatch(task, task_start, task_end);
+
+			auto late = task_start > task.when ? task_start - task.when : 0;
+			_metrics.lateness.record(late);
+			_metrics.lanes[(size_t)task.lane].lateness.record(late);
+			if(late > step_size)
+				_metrics.late_events.fetch_add(1, std::memory_order_relaxed);
+			current = task_end;
 		}
-
-		sys_current = now();
-		if(sys_current > last_sys_current)
-		{
-			current = sys_current;
-			last_sys_current = sys_current;
-			clock_gettime(CLOCK_REALTIME, &begin);
-		}
-		else
+		//sleep half way to the next task, or a whole window when there is nothing to do
+		current = now();
+		uint64_t next = 0;
+		uint64_t wait = step_size;
+		QueueDepth depth;
+		if(next_when(next, &depth))
+			wait = next > current ? (next - current) / 2 : 0;
+		_metrics.queue_depth.record(depth.total);
+		for(size_t i = 0; i < scheduler_lanes; i++)
+			_metrics.lanes[i].queue_depth.record(depth.lanes[i]);
+		if(wait > max_sleep)
 		{
-			clock_gettime(CLOCK_REALTIME, &next);
-			auto d = diff(begin, next);
-			current = sys_current;
-			current += d.tv_sec * 1000000000;
-			current += d.tv_nsec;
-		}
-
-		auto when = task_start - current;
-		when *= .5;
-		if((when > max_sleep && task_start > current) || !tasks.size())
-		{
-			short_sleep.tv_nsec = when;
+			short_sleep.tv_sec = wait / 1000000000;
+			short_sleep.tv_nsec = wait % 1000000000;
 			nanosleep(&short_sleep, &remaining);
+			auto slept = now() - current;
+			_metrics.sleep_overshoot.record(slept > wait ? slept - wait : 0);
 		}
 		else
 		{
-			sleep_skip++;
+			_metrics.sleep_skips.fetch_add(1, std::memory_order_relaxed);
 		}
-
 	}
+	stop_watchdog();
+	restore_config();
 }
 
 uint64_t Scheduler::calibrate_nanosleep()
@@ -6,9 +6,17 @@
 #include <thread>
 #include <atomic>
 #include <mutex>
+#include <vector>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <limits>
+#include <sched.h>
+#include "Histogram.h"
 
 namespace xerxzema
 {
+class EventRecorder;
 
 struct CallbackState
 {
@@ -24,11 +32,67 @@ struct CallbackState
 
 typedef void(*scheduler_callback)(void*);
 
+//tasks due in the same dispatch window run lane by lane, realtime first.
+//realtime is for io callbacks, timer for schedule instructions and background
+//for main program entries.
+enum class SchedulerLane : uint8_t
+{
+	Realtime,
+	Timer,
+	Background
+};
+static const size_t scheduler_lanes = 3;
+
+//Strict always serves the highest lane with a due task. Weighted lets each lane
+//run up to its weight in tasks before lower lanes get a turn, so a burst of
+//realtime callbacks can't starve the rest of the window.
+enum class LanePolicy
+{
+	Strict,
+	Weighted
+};
+
+//what happens to a new task once the queue is at capacity
+enum class OverloadPolicy
+{
+	//the new task is refused
+	Reject,
+	//the task with the earliest deadline makes room, it's the most out of date
+	DropOldest,
+	//a task from the lowest lane at or below the new task's lane makes room
+	DropLowest,
+	//a task already queued for the same state and callback stands in for the new one
+	Coalesce
+};
+
+//what producers get back from submit, jit'd code gets it as an int from xerxzema_schedule
+enum class ScheduleStatus : int64_t
+{
+	Rejected = -1,
+	Queued = 0,
+	//queued but the queue is past its high water mark, producers should back off
+	Pressure = 1,
+	//queued after another task was dropped to make room
+	Dropped = 2,
+	//merged into a task that was already queued
+	Coalesced = 3
+};
+
+//slot index in the low 32 bits, the slot's generation in the high ones.
+//a slot's generation moves on when its task finishes or is cancelled so old
+//handles stop matching. 0 is never a valid handle.
+typedef uint64_t scheduler_handle;
+
 struct CallbackData
 {
 	CallbackState* state;
 	scheduler_callback fn;
 	uint64_t when;
+	//0 for one shot callbacks, otherwise the task is re-armed at when + period
+	uint64_t period;
+	uint32_t slot;
+	uint32_t generation;
+	SchedulerLane lane;
 };
 
 inline bool operator < (const CallbackData& lhs, const CallbackData& rhs)
@@ -40,6 +104,137 @@ inline bool operator > (const CallbackData& lhs, const CallbackData& rhs)
 	return lhs.when > rhs.when;
 }
 
+struct LaneMetrics
+{
+	Histogram lateness;
+	//live tasks in the lane after each dispatch window
+	Histogram queue_depth;
+};
+
+//all times are in nanoseconds
+struct SchedulerMetrics
+{
+	SchedulerMetrics();
+	//how long after its when a callback started
+	Histogram lateness;
+	//time spent inside callbacks
+	Histogram execution;
+	//tasks still queued after each dispatch window
+	Histogram queue_depth;
+	//how much longer a sleep took than asked for
+	Histogram sleep_overshoot;
+	std::atomic<uint64_t> total_events;
+	//started more than a dispatch window after their when
+	std::atomic<uint64_t> late_events;
+	//the next task was too close to sleep for it
+	std::atomic<uint64_t> sleep_skips;
+	//what the overload policy did to tasks that didn't fit
+	std::atomic<uint64_t> rejected;
+	std::atomic<uint64_t> dropped;
+	std::atomic<uint64_t> coalesced;
+	//tasks queued past the high water mark
+	std::atomic<uint64_t> pressure;
+	//callbacks that ran past their program's budget
+	std::atomic<uint64_t> overruns;
+	LaneMetrics lanes[scheduler_lanes];
+	void reset();
+	void dump(FILE* file);
+};
+
+//tasks a producer thread can have waiting to be merged, a power of two
+static const uint64_t producer_capacity = 256;
+//threads past this many go through the task lock every time
+static const size_t max_producers = 64;
+
+struct PendingTask
+{
+	CallbackData task;
+	uint64_t enqueued;
+};
+
+//single producer ring of tasks submitted without the task lock. the producer is
+//the thread that owns it, the consumer is whoever holds the task lock.
+class ProducerBuffer
+{
+public:
+	ProducerBuffer(std::thread::id owner);
+	//false when full
+	bool push(const PendingTask& task);
+	template<class F>
+	size_t drain(F fn)
+	{
+		auto tail = read.load(std::memory_order_relaxed);
+		auto head = write.load(std::memory_order_acquire);
+		for(auto i = tail; i < head; i++)
+			fn(tasks[i & (producer_capacity - 1)]);
+		read.store(head, std::memory_order_release);
+		return head - tail;
+	}
+	inline std::thread::id owner() const { return _owner; }
+private:
+	PendingTask tasks[producer_capacity];
+	std::atomic<uint64_t> write;
+	std::atomic<uint64_t> read;
+	std::thread::id _owner;
+};
+
+//applied by run on the thread that ends up running the scheduler. anything the
+//process isn't allowed to do (no CAP_SYS_NICE, a low RLIMIT_MEMLOCK) is warned
+//about and skipped. the defaults leave the thread as it was.
+struct SchedulerConfig
+{
+	SchedulerConfig();
+	//pin the scheduler thread to this cpu, -1 leaves it to the os
+	int cpu;
+	//SCHED_FIFO priority 1-99, 0 keeps the default policy
+	int fifo_priority;
+	//mlockall current and future pages so nothing is paged out under a callback
+	bool lock_memory;
+	//touch program state and jit'd code before they are first run
+	bool prefault;
+	//bytes of stack touched up front so deep callbacks don't fault in new stack pages
+	size_t prefault_stack;
+	//run every callback with denormals flushed to zero (FTZ/DAZ). this is for the
+	//whole thread so it applies to every program, whatever its float mode.
+	bool flush_denormals;
+	//budget in nanoseconds given to every program the session starts, 0 for none
+	uint64_t program_budget;
+	//warns about a callback that is still running after this many nanoseconds,
+	//0 leaves the watchdog thread off
+	uint64_t watchdog;
+};
+
+//execution budget of one program, see Scheduler::budget
+struct ProgramBudget
+{
+	std::string name;
+	uint64_t budget;
+	uint64_t runs;
+	uint64_t overruns;
+	//overruns in a row, a run inside the budget starts it over
+	uint32_t streak;
+	uint64_t worst;
+	//moved to the background lane for overrunning too often
+	bool demoted;
+};
+
+//the live side of a ProgramBudget. the scheduler thread counts into it without
+//the task lock, name and demoted only change under it.
+struct BudgetCounters
+{
+	std::string name;
+	std::atomic<uint64_t> budget;
+	std::atomic<uint64_t> runs;
+	std::atomic<uint64_t> overruns;
+	std::atomic<uint32_t> streak;
+	std::atomic<uint64_t> worst;
+	std::atomic<bool> demoted;
+};
+
+//touches every page in the range so the first real access doesn't fault.
+//read only ranges (code) are only read from.
+void prefault(void* memory, size_t size, bool writable);
+
 class Scheduler
 {
 public:
@@ -48,21 +243,149 @@ public:
 	void run_async();
 	void wait();
 	void shutdown();
-	void schedule(scheduler_callback callback, void* state, uint64_t when);
+	//takes effect the next time run starts
+	void configure(const SchedulerConfig& config);
+	inline const SchedulerConfig& config() const { return _config; }
+	//handle is 0 unless the task was queued or coalesced
+	ScheduleStatus submit(scheduler_callback callback, void* state, uint64_t when,
+						  uint64_t period = 0, SchedulerLane lane = SchedulerLane::Timer,
+						  scheduler_handle* handle = nullptr);
+	//lock free submit, the task goes into this thread's own buffer and is
+	//merged into the queue at the start of the next dispatch window. an
+	//unbounded queue can't overflow so the status is always Queued. once
+	//capacity is set this is the same as submit, a full buffer falls back to
+	//submit too.
+	ScheduleStatus submit_local(scheduler_callback callback, void* state, uint64_t when,
+								SchedulerLane lane = SchedulerLane::Timer);
+	//0 when the task didn't fit
+	scheduler_handle schedule(scheduler_callback callback, void* state, uint64_t when,
+							  SchedulerLane lane = SchedulerLane::Timer);
+	//runs at first, first + period, first + 2 * period... the next deadline is
+	//computed from the previous one so late callbacks don't drift the timer.
+	//a period of 0 runs once.
+	scheduler_handle schedule_periodic(scheduler_callback callback, void* state, uint64_t first,
+									   uint64_t period, SchedulerLane lane = SchedulerLane::Timer);
+	//the task is marked dead in O(1) and dropped when it reaches the front of
+	//the queue. returns false when the task already ran or was cancelled.
+	bool cancel(scheduler_handle handle);
+	//cancels everything scheduled with this state, for program destructors
+	void cancel_state(void* state);
+	//bounds the number of live tasks, 0 (the default) is unbounded.
+	//past high_water percent of capacity producers see Pressure.
+	void capacity(size_t tasks, OverloadPolicy policy, uint32_t high_water = 75);
+	//every submitted task is also written to the recorder, nullptr stops recording
+	void record(EventRecorder* recorder);
+	//callbacks run with this state (one per program instance) that take longer
+	//than budget nanoseconds are counted as overruns and reported with name
+	void budget(void* state, const std::string& name, uint64_t budget);
+	//after this many overruns in a row a program's tasks move to the background
+	//lane, 0 (the default) never demotes
+	void demote_after(uint32_t overruns);
+	std::vector<ProgramBudget> budgets();
+	//one line per program with a budget, worst offenders first
+	void report_budgets(FILE* file);
+	void lane_policy(LanePolicy policy);
+	void lane_weight(SchedulerLane lane, uint32_t weight);
+	size_t task_count(SchedulerLane lane);
 	uint64_t calibrate_nanosleep();
 	inline void exit_when_empty() { exit_if_empty = true; }
+	//run jumps straight to the next deadline instead of sleeping until it, for
+	//batch rendering and replaying recorded input. callbacks see the same
+	//exec_time as in a real time run, so deterministic programs give the same
+	//output, as fast as the cpu allows. stops once the queue is empty or the
+	//next deadline is past until.
+	void offline(uint64_t until = std::numeric_limits<uint64_t>::max());
+	//the scheduler's clock, wall time or the virtual time of an offline run
+	uint64_t time();
+	//safe to read from any thread while the scheduler runs
+	inline SchedulerMetrics& metrics() { return _metrics; }
 private:
+	//live tasks, cancelled ones still in the heap don't count
 	size_t task_count();
-	CallbackData pop_task();
-	const CallbackData* peek_task();
+	//takes a live task due before the deadline from the lane the policy picks,
+	//periodic tasks stay in the queue and get re-armed instead
+	bool pop_task(uint64_t before, CallbackData& task);
+	//how many live tasks were queued, in total and per lane
+	struct QueueDepth
+	{
+		size_t total;
+		size_t lanes[scheduler_lanes];
+	};
+	//when of the first live task in any lane, also snapshots the queue depth
+	//under the same lock when depth isn't null
+	bool next_when(uint64_t& when, QueueDepth* depth = nullptr);
+	ScheduleStatus push_task(CallbackData task, scheduler_handle* handle);
+	//this thread's buffer, nullptr once every producer slot is taken
+	ProducerBuffer* producer();
+	//a new dispatch window, refills the weighted credits
+	void begin_window();
+	//these expect task_lock to be held
+	void drop_dead(std::vector<CallbackData>& heap);
+	int pick_lane(uint64_t before);
+	inline bool is_live(const CallbackData& task) { return generations[task.slot] == task.generation; }
+	void release_slot(uint32_t slot);
+	ScheduleStatus insert(CallbackData task, scheduler_handle* handle, uint64_t enqueued);
+	//moves tasks from the producer buffers into the queue
+	void merge_pending();
+	inline size_t queued() { return generations.size() - free_slots.size(); }
+	//applies the overload policy, Dropped means there is room now
+	ScheduleStatus overflow(const CallbackData& task, scheduler_handle* handle);
+	void apply_config();
+	void restore_config();
+	//called after every callback with a budget, only locks to report or demote
+	void check_budget(BudgetCounters* b, void* state, uint64_t elapsed);
+	//these expect task_lock to be held
+	void demote(void* state);
+	bool is_demoted(void* state);
+	void watchdog_loop();
+	void start_watchdog();
+	void stop_watchdog();
+	//runs one callback and times it
+	void dispatch(const CallbackData& task, uint64_t& start, uint64_t& end);
+	void run_offline();
 
-	std::priority_queue<CallbackData, std::vector<CallbackData>,
-						std::greater<CallbackData>> tasks;
+	//a min heap on when per lane
+	std::vector<CallbackData> tasks[scheduler_lanes];
+	std::vector<uint32_t> generations;
+	std::vector<SchedulerLane> slot_lanes;
+	std::vector<uint32_t> free_slots;
+	size_t live[scheduler_lanes];
+	LanePolicy policy;
+	uint32_t weights[scheduler_lanes];
+	uint32_t credits[scheduler_lanes];
+	//read without the lock by submit_local
+	std::atomic<size_t> _capacity;
+	size_t high_water;
+	OverloadPolicy overload;
+	EventRecorder* recorder;
 	bool exit_if_empty;
+	bool offline_mode;
+	uint64_t offline_until;
+	std::atomic<uint64_t> virtual_time;
 	std::thread main_thread;
 	std::atomic<bool> running;
 	std::mutex task_lock;
-
+	std::unique_ptr<ProducerBuffer> producers[max_producers];
+	std::atomic<size_t> producer_count;
+	std::mutex producer_lock;
+	uint64_t id;
+	std::unordered_map<void*, std::unique_ptr<BudgetCounters>> _budgets;
+	std::atomic<bool> has_budgets;
+	std::atomic<uint32_t> demote_streak;
+	//budget of the task pop_task just handed out, only the run loop touches it
+	BudgetCounters* dispatch_budget;
+	//what the run loop is doing, for the watchdog
+	std::atomic<uint64_t> dispatch_start;
+	std::atomic<void*> dispatch_state;
+	std::atomic<bool> watching;
+	std::thread watchdog_thread;
+	SchedulerMetrics _metrics;
+	SchedulerConfig _config;
+	//what apply_config changed on the thread that called run
+	uint64_t saved_float_control;
+	cpu_set_t saved_cpus;
+	int saved_policy;
+	sched_param saved_param;
 };
 
 uint64_t now();
@@ -3,6 +3,7 @@
 #include "StlUtils.h"
 #include "World.h"
 #include "Namespace.h"
+#include <cmath>
 
 namespace xerxzema
 {
@@ -55,7 +56,11 @@ void HandleCodeDefinitionSignature::process()
 	state = ProcessState::Entry;
 	def->signature->accept(*this);
 	if(valid) // TODO and NOT generic?
+	{
 		ns->add_instruction(std::make_unique<ProgramCallDefinition>(prog));
+		ns->add_instruction(std::make_unique<ProgramMapDefinition>(prog));
+		ns->add_instruction(std::make_unique<ProgramFoldDefinition>(prog));
+	}
 }
 
 void HandleCodeDefinitionSignature::visit(BindExpression *e)
@@ -99,6 +104,8 @@ void HandleCodeDefinitionSignature::visit(SymbolExpression* e)
 	if(state == ProcessState::Name)
 	{
 		prog = ns->get_program(e->token->data);
+		if(def->token->type == TokenType::UgenKeyword)
+			prog->block_size(Program::default_block_size);
 	}
 	else if(state == ProcessState::GetArgName)
 	{
@@ -150,10 +157,17 @@ void HandleCodeDefinitionSignature::visit(xerxzema::AnnotationExpression *e)
 
 		if(ns->is_type(current_arg_type))
 		{
+			auto type = ns->type(current_arg_type);
 			if(last_state == ProcessState::InputArgs)
-				prog->add_input(current_arg_name, ns->type(current_arg_type));
+				prog->add_input(current_arg_name, type);
 			if(last_state == ProcessState::OutputArgs)
-				prog->add_output(current_arg_name, ns->type(current_arg_type));
+			{
+				//ugen outputs are signals, they carry a block per activation.
+				//inputs stay control rate.
+				if(prog->block_size() > 0 && type->name() == "real")
+					type = ns->type("array", {type});
+				prog->add_output(current_arg_name, type);
+			}
 		}
 		else
 		{
@@ -262,6 +276,30 @@ void HandleExpression::visit(xerxzema::RealExpression *e)
 	}
 }
 
+void HandleExpression::visit(xerxzema::IntExpression *e)
+{
+	auto value = strtoll(e->token->data.c_str(), nullptr, 10);
+	if(result.size() == 0)
+	{
+		result.push_back(program->constant_int(value));
+	}
+	else
+	{
+		//assign this value to a named register
+		auto inst = std::make_unique<ValueInt>(value);
+		inst->dependent(program->reg("head"));
+		for(auto& r: dependencies)
+			inst->dependent(r.reg);
+		inst->output(result[0].reg);
+		program->instruction(std::move(inst));
+		if(!result[0].reg->type())
+		{
+			result[0].reg->type(program->name_space()->world()
+								->get_namespace("core")->type("int"));
+		}
+	}
+}
+
 void HandleExpression::visit(xerxzema::StringExpression *e)
 {
 	auto string_value = e->token->data;
@@ -323,6 +361,16 @@ void HandleExpression::visit(xerxzema::DivExpression *e)
 	do_binary_instruction(e, e->lhs.get(), e->rhs.get(), "div");
 }
 
+void HandleExpression::visit(xerxzema::ModExpression *e)
+{
+	do_binary_instruction(e, e->lhs.get(), e->rhs.get(), "mod");
+}
+
+void HandleExpression::visit(xerxzema::PowExpression *e)
+{
+	do_binary_instruction(e, e->lhs.get(), e->rhs.get(), "pow");
+}
+
 void HandleExpression::visit(xerxzema::LtExpression *e)
 {
 	do_binary_instruction(e, e->lhs.get(), e->rhs.get(), "lt");
@@ -417,6 +465,16 @@ void HandleExpression::visit(xerxzema::CallExpression *e)
 		return;
 	}
 	auto target = e->target->as_a<SymbolExpression>()->token->data;
+	if(target == "map" || target == "fold")
+	{
+		do_program_call(e, target);
+		return;
+	}
+	if(target == "shuffle")
+	{
+		do_shuffle(e);
+		return;
+	}
 	HandleExpression args(program, e->args.get(), {}, dependencies);
 	args.process();
 	if(result.size() == 0)
@@ -424,6 +482,90 @@ void HandleExpression::visit(xerxzema::CallExpression *e)
 	program->instruction(target, args.result, result, dependencies, e);
 }
 
+static void flatten_args(Expression* e, std::vector<Expression*>& args)
+{
+	if(e->is_a<ArgListExpression>())
+	{
+		auto list = e->as_a<ArgListExpression>();
+		flatten_args(list->lhs.get(), args);
+		flatten_args(list->rhs.get(), args);
+	}
+	else
+	{
+		args.push_back(e);
+	}
+}
+
+//map(f, xs) and fold(f, init, xs) take a program as the first argument, that
+//never becomes a register, it picks the map.f/fold.f instruction instead.
+void HandleExpression::do_program_call(CallExpression* e, const std::string& target)
+{
+	std::vector<Expression*> args;
+	flatten_args(e->args.get(), args);
+	if(args.size() < 2 || !args[0]->is_a<SymbolExpression>() ||
+	   !program->name_space()->is_program(args[0]->token->data))
+	{
+		emit_error(e->token.get(), target + " needs a program as the first argument");
+		valid = false;
+		return;
+	}
+
+	std::vector<RegisterData> inputs;
+	for(size_t i = 1; i < args.size(); i++)
+	{
+		HandleExpression arg(program, args[i], {}, dependencies);
+		arg.process();
+		valid = valid && arg.valid;
+		inputs = combine_vectors(inputs, arg.result);
+	}
+	if(result.size() == 0)
+		result.push_back(program->temp_reg());
+	program->instruction(target + "." + args[0]->token->data, inputs, result, dependencies, e);
+}
+
+//shuffle(v, 3, 2, 1, 0), the lanes have to be literals so they end up in the
+//instruction name and codegen can emit a single shufflevector.
+void HandleExpression::do_shuffle(CallExpression* e)
+{
+	std::vector<Expression*> args;
+	flatten_args(e->args.get(), args);
+	std::vector<uint32_t> mask;
+	for(size_t i = 1; i < args.size(); i++)
+	{
+		double lane = -1;
+		if(args[i]->is_a<IntExpression>())
+			lane = strtoll(args[i]->token->data.c_str(), nullptr, 10);
+		else if(args[i]->is_a<RealExpression>())
+			lane = atof(args[i]->token->data.c_str());
+		if(lane < 0 || lane != std::trunc(lane))
+		{
+			emit_error(args[i]->token.get(), "shuffle lanes have to be literal indices");
+			valid = false;
+			return;
+		}
+		mask.push_back((uint32_t)lane);
+	}
+	if(mask.size() == 0)
+	{
+		emit_error(e->token.get(), "shuffle needs a vector and at least one lane");
+		valid = false;
+		return;
+	}
+
+	auto def = std::make_unique<VectorShuffleDefinition>(mask);
+	auto name = def->name();
+	auto ns = program->name_space();
+	if(!ns->has_instruction(name))
+		ns->add_instruction(std::move(def));
+
+	HandleExpression arg(program, args[0], {}, dependencies);
+	arg.process();
+	valid = valid && arg.valid;
+	if(result.size() == 0)
+		result.push_back(program->temp_reg());
+	program->instruction(name, arg.result, result, dependencies, e);
+}
+
 void HandleExpression::visit(xerxzema::ListExpression *e)
 {
 
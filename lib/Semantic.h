@@ -89,12 +89,15 @@ public:
 	void visit(SymbolExpression* e);
 	void visit(SampleExpression* e);
 	void visit(RealExpression* e);
+	void visit(IntExpression* e);
 	void visit(StringExpression* e);
 	void visit(ArgListExpression* e);
 	void visit(AddExpression* e);
 	void visit(SubExpression* e);
 	void visit(MulExpression* e);
 	void visit(DivExpression* e);
+	void visit(ModExpression* e);
+	void visit(PowExpression* e);
 	void visit(LtExpression* e);
 	void visit(GroupExpression* e);
 	void visit(BangExpression* e);
@@ -112,6 +115,8 @@ public:
 private:
 	void do_binary_instruction(Expression* parent, Expression* lhs,
 							   Expression* rhs, const std::string& op);
+	void do_program_call(CallExpression* e, const std::string& target);
+	void do_shuffle(CallExpression* e);
 	Program* program;
 	Expression* expr;
 	bool valid;
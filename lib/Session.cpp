@@ -36,10 +36,16 @@ void Session::eval(const std::string& str, const std::string& ns)
 	//start the scheduler if it's not running?
 	//the malloc'd buffer will change size...
 	//so nuke it for now and this is a todo...
-	auto state = malloc(world->jit()->get_state_size(program));
-	memset(state, 0, world->jit()->get_state_size(program));
+	auto scheduler = world->scheduler();
+	auto state_size = world->jit()->get_state_size(program);
+	auto state = malloc(state_size);
+	//the memset faults the state in, prefault has nothing left to touch here
+	memset(state, 0, state_size);
+	if(scheduler->config().program_budget)
+		scheduler->budget(state, program->symbol_name(), scheduler->config().program_budget);
 	auto raw_fn = world->jit()->get_jitted_function(program);
-	world->scheduler()->schedule((scheduler_callback)raw_fn, state, now());
+	scheduler->schedule((scheduler_callback)raw_fn, state, scheduler->time(),
+						SchedulerLane::Background);
 }
 
 };
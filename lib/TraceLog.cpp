@@ -0,0 +1,177 @@
+#include "TraceLog.h"
+#include "Scheduler.h"
+#include <string.h>
+#include <chrono>
+
+namespace xerxzema
+{
+
+//how long the background thread sleeps between drains
+static const auto drain_period = std::chrono::milliseconds(5);
+
+TraceBuffer::TraceBuffer(std::thread::id owner) : _owner(owner)
+{
+	write.store(0);
+	read.store(0);
+	_dropped.store(0);
+}
+
+bool TraceBuffer::push(const TraceRecord& record)
+{
+	auto head = write.load(std::memory_order_relaxed);
+	if(head - read.load(std::memory_order_acquire) == trace_buffer_capacity)
+	{
+		_dropped.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+	records[head & (trace_buffer_capacity - 1)] = record;
+	write.store(head + 1, std::memory_order_release);
+	return true;
+}
+
+//every log gets its own id so a thread's cached buffer can't outlive its log
+static std::atomic<uint64_t> next_log_id(1);
+static thread_local uint64_t cached_log = 0;
+static thread_local TraceBuffer* cached_buffer = nullptr;
+
+TraceLog::TraceLog(bool bg) : file(stdout), _written(0), background(bg),
+							  id(next_log_id.fetch_add(1))
+{
+	running.store(true);
+	if(background)
+		drain_thread = std::thread(&TraceLog::drain_loop, this);
+}
+
+TraceLog::~TraceLog()
+{
+	running.store(false);
+	if(drain_thread.joinable())
+		drain_thread.join();
+	drain();
+}
+
+uint32_t TraceLog::site(const std::string& program, const std::string& reg)
+{
+	std::lock_guard<std::mutex> guard(lock);
+	auto key = std::make_pair(program, reg);
+	for(size_t i = 0; i < sites.size(); i++)
+	{
+		if(sites[i] == key)
+			return i;
+	}
+	sites.push_back(key);
+	return sites.size() - 1;
+}
+
+//only the first trace on a thread takes the lock
+TraceBuffer* TraceLog::buffer()
+{
+	if(cached_log == id)
+		return cached_buffer;
+
+	std::lock_guard<std::mutex> guard(lock);
+	auto self = std::this_thread::get_id();
+	TraceBuffer* found = nullptr;
+	for(auto& b: buffers)
+	{
+		if(b->owner() == self)
+			found = b.get();
+	}
+	if(!found)
+	{
+		buffers.push_back(std::make_unique<TraceBuffer>(self));
+		found = buffers.back().get();
+	}
+	cached_log = id;
+	cached_buffer = found;
+	return found;
+}
+
+void TraceLog::trace_real(uint32_t site, double value)
+{
+	TraceRecord record;
+	record.time = now();
+	record.site = site;
+	record.is_text = 0;
+	record.length = 0;
+	record.real = value;
+	buffer()->push(record);
+}
+
+void TraceLog::trace_string(uint32_t site, const char* data, int64_t size)
+{
+	TraceRecord record;
+	record.time = now();
+	record.site = site;
+	record.is_text = 1;
+	//strings from literals carry their terminator
+	while(size > 0 && data[size - 1] == 0)
+		size--;
+	record.length = std::min<int64_t>(std::max<int64_t>(size, 0), trace_text_bytes);
+	memcpy(record.text, data, record.length);
+	buffer()->push(record);
+}
+
+void TraceLog::write_record(const TraceRecord& record)
+{
+	auto name = record.site < sites.size() ? sites[record.site].second.c_str() : "unknown";
+	if(!record.is_text)
+		fprintf(file, "(%s) %f\n", name, record.real);
+	else
+		fprintf(file, "(%s) %.*s\n", name, (int)record.length, record.text);
+}
+
+size_t TraceLog::drain()
+{
+	std::lock_guard<std::mutex> guard(lock);
+	size_t count = 0;
+	for(auto& b: buffers)
+	{
+		count += b->drain([this](const TraceRecord& record)
+		{
+			write_record(record);
+		});
+	}
+	if(count)
+		fflush(file);
+	_written += count;
+	return count;
+}
+
+void TraceLog::drain_loop()
+{
+	while(running.load())
+	{
+		drain();
+		std::this_thread::sleep_for(drain_period);
+	}
+}
+
+void TraceLog::output(FILE* f)
+{
+	std::lock_guard<std::mutex> guard(lock);
+	file = f;
+}
+
+uint64_t TraceLog::written()
+{
+	std::lock_guard<std::mutex> guard(lock);
+	return _written;
+}
+
+uint64_t TraceLog::dropped()
+{
+	std::lock_guard<std::mutex> guard(lock);
+	uint64_t total = 0;
+	for(auto& b: buffers)
+		total += b->dropped();
+	return total;
+}
+
+TraceLog* trace_log()
+{
+	static TraceLog log;
+	return &log;
+}
+
+};
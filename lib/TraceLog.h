@@ -0,0 +1,104 @@
+#pragma once
+#include <stdint.h>
+#include <stdio.h>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <string>
+#include <memory>
+
+namespace xerxzema
+{
+
+//records per thread, a power of two
+static const uint64_t trace_buffer_capacity = 4096;
+//strings are cut down to this many bytes, the record has to stay fixed size
+static const size_t trace_text_bytes = 24;
+
+//what the trace instruction writes, formatting happens later on the drain thread.
+//site maps back to the program and register names, see TraceLog::site
+struct TraceRecord
+{
+	uint64_t time;
+	uint32_t site;
+	uint16_t is_text;
+	uint16_t length;
+	union
+	{
+		double real;
+		char text[trace_text_bytes];
+	};
+};
+
+//single producer single consumer ring, the producer is the thread running the
+//trace and the consumer is whoever drains the log. full rings drop the record
+//and count it instead of blocking the producer.
+class TraceBuffer
+{
+public:
+	TraceBuffer(std::thread::id owner);
+	bool push(const TraceRecord& record);
+	//hands every record written so far to fn, returns how many there were
+	template<class F>
+	size_t drain(F fn)
+	{
+		auto tail = read.load(std::memory_order_relaxed);
+		auto head = write.load(std::memory_order_acquire);
+		for(auto i = tail; i < head; i++)
+			fn(records[i & (trace_buffer_capacity - 1)]);
+		read.store(head, std::memory_order_release);
+		return head - tail;
+	}
+	inline std::thread::id owner() const { return _owner; }
+	inline uint64_t dropped() const { return _dropped.load(std::memory_order_relaxed); }
+private:
+	TraceRecord records[trace_buffer_capacity];
+	std::atomic<uint64_t> write;
+	std::atomic<uint64_t> read;
+	std::atomic<uint64_t> _dropped;
+	std::thread::id _owner;
+};
+
+//collects trace records from every thread that traces and writes them out as text.
+//with a background thread the log drains itself every few milliseconds,
+//otherwise the owner calls drain.
+class TraceLog
+{
+public:
+	TraceLog(bool background = true);
+	~TraceLog();
+	//sites are created at compile time, one per traced register. the output
+	//only names the register, same as the old printf trace.
+	uint32_t site(const std::string& program, const std::string& reg);
+	void trace_real(uint32_t site, double value);
+	void trace_string(uint32_t site, const char* data, int64_t size);
+	//formats everything buffered so far, returns the number of records written
+	size_t drain();
+	//defaults to stdout
+	void output(FILE* file);
+	uint64_t written();
+	//records lost to full buffers
+	uint64_t dropped();
+
+private:
+	TraceBuffer* buffer();
+	void write_record(const TraceRecord& record);
+	void drain_loop();
+
+	std::mutex lock;
+	std::vector<std::unique_ptr<TraceBuffer>> buffers;
+	//program and register of each site
+	std::vector<std::pair<std::string, std::string>> sites;
+	FILE* file;
+	uint64_t _written;
+	bool background;
+	uint64_t id;
+	std::atomic<bool> running;
+	std::thread drain_thread;
+};
+
+//the log the jit'd trace instruction writes to
+TraceLog* trace_log();
+
+};
@@ -113,7 +113,9 @@ llvm::Function* Transformer::generate_transformer(llvm::LLVMContext& context)
 
 	for(auto mapping: reusable_registers)
 	{
-		if(mapping.prev->offset() > 0)
+		//a register that became transient (or stopped being one) has nothing to carry over
+		if(mapping.prev->has_slot() && mapping.next->has_slot() &&
+		   !mapping.prev->is_transient() && !mapping.next->is_transient())
 		{
 			auto prev_ptr = builder.CreateStructGEP(prev_type, prev_arg, mapping.prev->offset());
 			auto next_ptr = builder.CreateStructGEP(next_type, next_arg, mapping.next->offset());
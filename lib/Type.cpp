@@ -1,6 +1,7 @@
 #include "Type.h"
 #include "Program.h"
 #include "Namespace.h"
+#include "ArrayStorage.h"
 
 namespace xerxzema
 {
@@ -79,6 +80,23 @@ std::string Real::name()
 	return "real";
 }
 
+//single precision, half the memory traffic and twice the simd lanes of real
+llvm::Type* Real32::type(llvm::LLVMContext &context)
+{
+	return llvm::Type::getFloatTy(context);
+}
+
+void Real32::init(llvm::LLVMContext &context, llvm::IRBuilder<> &builder,
+				  Program* program, llvm::Value *value)
+{
+	builder.CreateStore(llvm::ConstantFP::get(type(context), 0), value);
+}
+
+std::string Real32::name()
+{
+	return "real32";
+}
+
 llvm::Type* Int::type(llvm::LLVMContext &context)
 {
 	return llvm::Type::getInt64Ty(context);
@@ -129,6 +147,47 @@ void Opaque::init(llvm::LLVMContext &context, llvm::IRBuilder<> &builder,
 	builder.CreateStore(llvm::ConstantInt::get(type(context), 0), value);
 }
 
+Vector::Vector(Type* element, uint32_t width) : _element(element), _width(width)
+{
+
+}
+
+std::string Vector::name()
+{
+	return "vec" + std::to_string(_width) + "." + _element->name();
+}
+
+llvm::Type* Vector::type(llvm::LLVMContext &context)
+{
+	return llvm::VectorType::get(_element->type(context), _width);
+}
+
+void Vector::init(llvm::LLVMContext &context, llvm::IRBuilder<> &builder,
+				  Program* program, llvm::Value *value)
+{
+	builder.CreateStore(llvm::ConstantAggregateZero::get(type(context)), value);
+}
+
+void Vector::move(llvm::LLVMContext &context, llvm::IRBuilder<> &builder,
+				  Program* program, llvm::Value *dst_ptr, llvm::Value *src_ptr)
+{
+	copy(context, builder, program, dst_ptr, src_ptr);
+}
+
+void Vector::copy(llvm::LLVMContext &context, llvm::IRBuilder<> &builder,
+				  Program* program, llvm::Value *dst_ptr, llvm::Value *src_ptr)
+{
+	unsigned align = _element->type(context)->getPrimitiveSizeInBits() / 8;
+	auto v = builder.CreateAlignedLoad(src_ptr, align);
+	builder.CreateAlignedStore(v, dst_ptr, align);
+}
+
+uint32_t vector_width(Type* type)
+{
+	auto vector = dynamic_cast<Vector*>(type);
+	return vector ? vector->width() : 0;
+}
+
 Array::Array() : cached_type(nullptr)
 {
 
@@ -156,6 +215,8 @@ llvm::Type* Array::type(llvm::LLVMContext& context)
 	arg_types.push_back(type_params[0]->type(context)->getPointerTo());
 	arg_types.push_back(llvm::Type::getInt64Ty(context)); // number of elements
 	arg_types.push_back(llvm::Type::getInt64Ty(context)); // size of allocation
+	arg_types.push_back(llvm::ArrayType::get(llvm::Type::getInt8Ty(context),
+											 array_inline_bytes)); // small arrays
 	cached_type = llvm::StructType::create(context, arg_types, name());
 	return cached_type;
 }
@@ -169,21 +230,59 @@ void Array::init(llvm::LLVMContext &context, llvm::IRBuilder<> &builder,
 
 }
 
+static void call_array_runtime(llvm::LLVMContext &context, llvm::IRBuilder<> &builder,
+							   Program* program, const std::string& name, llvm::Value* array)
+{
+	auto fn = program->name_space()->get_external_function(name, program->current_module(),
+														   context);
+	builder.CreateCall(fn, {builder.CreatePointerCast(array, llvm::Type::getInt8PtrTy(context))});
+}
+
+//inline arrays point data at their own storage, after the struct is copied
+//somewhere else it has to point at the new copy
+static void generate_inline_fixup(llvm::LLVMContext &context, llvm::IRBuilder<> &builder,
+								  llvm::Type* array_type, llvm::Value* array)
+{
+	auto data_ptr = builder.CreateStructGEP(array_type, array, 0);
+	auto data = builder.CreateLoad(data_ptr);
+	auto alloc = builder.CreateLoad(builder.CreateStructGEP(array_type, array, 2));
+	auto inline_data = builder.CreatePointerCast(builder.CreateStructGEP(array_type, array, 3),
+												 data->getType());
+	auto is_inline = builder.CreateICmpEQ(alloc, builder.getInt64(array_inline));
+	builder.CreateStore(builder.CreateSelect(is_inline, inline_data, data), data_ptr);
+}
+
+//the source is dead after a move, moving a register onto itself is not allowed
+void Array::move(llvm::LLVMContext &context, llvm::IRBuilder<> &builder,
+				 Program* program, llvm::Value *dst_ptr, llvm::Value *src_ptr)
+{
+	auto v = builder.CreateLoad(src_ptr);
+	call_array_runtime(context, builder, program, "array_release", dst_ptr);
+	builder.CreateStore(v, dst_ptr);
+	generate_inline_fixup(context, builder, type(context), dst_ptr);
+	auto sz = llvm::ConstantExpr::getSizeOf(type(context));
+	builder.CreateMemSet(src_ptr, builder.getInt8(0), sz, 0);
+}
+
+void Array::copy(llvm::LLVMContext &context, llvm::IRBuilder<> &builder,
+				 Program* program, llvm::Value *dst_ptr, llvm::Value *src_ptr)
+{
+	//load first so copying an array onto itself keeps it alive
+	auto v = builder.CreateLoad(src_ptr);
+	call_array_runtime(context, builder, program, "array_retain", src_ptr);
+	call_array_runtime(context, builder, program, "array_release", dst_ptr);
+	builder.CreateStore(v, dst_ptr);
+	generate_inline_fixup(context, builder, type(context), dst_ptr);
+}
+
 void Array::destroy(llvm::LLVMContext &context, llvm::IRBuilder<> &builder,
 					Program* program, llvm::Value *v)
 {
-	auto deallocator = program->name_space()->get_external_function("free",
-																	program->current_module(),
-																	context);
-	auto data_ptr = builder.CreateStructGEP(type(context), v, 0);
-	auto val_ptr = builder.CreateLoad(data_ptr);
-
-	if(type_params[0]->is_trivial())
-	{
-		auto void_cast = builder.CreatePointerCast(val_ptr, llvm::Type::getInt8PtrTy(context));
-		builder.CreateCall(deallocator, {void_cast});
-		auto sz = llvm::ConstantExpr::getSizeOf(type(context));
-		builder.CreateMemSet(v, builder.getInt8(0), sz, 0);
-	}
+	call_array_runtime(context, builder, program, "array_release", v);
+}
+
+bool Array::accepts(const std::vector<Type*>& params)
+{
+	return params.size() == 1 && params[0]->is_trivial();
 }
 };
@@ -30,6 +30,9 @@ class ParameterizedType : public Type
 {
 public:
 	virtual std::unique_ptr<ParameterizedType> instantiate(const std::vector<Type*>& params) = 0;
+	//Namespace::type gives back nullptr for params this returns false for
+	virtual bool accepts(const std::vector<Type*>& params) { return true; }
+	inline const std::vector<Type*>& params() { return type_params; }
 protected:
 	std::vector<Type*> type_params;
 };
@@ -44,8 +47,18 @@ public:
 	void init(llvm::LLVMContext& context, llvm::IRBuilder<>& builder,
 			  Program* program, llvm::Value* val);
 	inline bool is_trivial() { return false; }
+	//copies share the buffer and bump its reference count, moves hand the
+	//reference over and leave the source empty. small arrays are stored inline
+	//and copied by value. see ArrayStorage.h
+	void move(llvm::LLVMContext& context, llvm::IRBuilder<>& builder,
+			  Program* program, llvm::Value* dst_ptr, llvm::Value* src_ptr);
+	void copy(llvm::LLVMContext& context, llvm::IRBuilder<>& builder,
+			  Program* program, llvm::Value* dst_ptr, llvm::Value* src_ptr);
 	void destroy(llvm::LLVMContext& context, llvm::IRBuilder<>& builder,
 				 Program* program, llvm::Value* v);
+	//only trivial elements for now. the runtime frees buffers without knowing
+	//the element type, so arrays of arrays (or strings) would leak their elements.
+	bool accepts(const std::vector<Type*>& params);
 
 private:
 	llvm::Type* cached_type;
@@ -62,7 +75,35 @@ DECL_TYPE(Bool)
 DECL_TYPE(Byte)
 DECL_TYPE(Unit)
 DECL_TYPE(Real)
+DECL_TYPE(Real32)
 DECL_TYPE(Int)
 DECL_TYPE(Opaque)
 
+//fixed width vectors, vec4.real is a <4 x double>. arithmetic on these is a
+//single vector instruction instead of one instruction per component.
+class Vector : public Type
+{
+public:
+	Vector(Type* element, uint32_t width);
+	std::string name();
+	llvm::Type* type(llvm::LLVMContext& context);
+	void init(llvm::LLVMContext& context, llvm::IRBuilder<>& builder,
+			  Program* program, llvm::Value* val);
+	//state buffers only have malloc alignment so these don't assume the
+	//natural alignment of the vector
+	void move(llvm::LLVMContext& context, llvm::IRBuilder<>& builder,
+			  Program* program, llvm::Value* dst_ptr, llvm::Value* src_ptr);
+	void copy(llvm::LLVMContext& context, llvm::IRBuilder<>& builder,
+			  Program* program, llvm::Value* dst_ptr, llvm::Value* src_ptr);
+	inline Type* element() { return _element; }
+	inline uint32_t width() { return _width; }
+
+private:
+	Type* _element;
+	uint32_t _width;
+};
+
+//width of a vecN type, 0 for anything else
+uint32_t vector_width(Type* type);
+
 };
@@ -82,6 +82,7 @@ void World::create_core_namespace()
 	core->add_type("byte", std::make_unique<Byte>());
 	core->add_type("int", std::make_unique<Int>());
 	core->add_type("real", std::make_unique<Real>());
+	core->add_type("real32", std::make_unique<Real32>());
 	core->add_type("unit", std::make_unique<Unit>());
 	core->add_type("opaque", std::make_unique<Opaque>());
 	core->add_parameterized_type("array", std::make_unique<Array>());
@@ -100,11 +101,81 @@ void World::create_core_namespace()
 	core->add_instruction(create_def<GtReal>("gt", {"real", "real"}, {"bool"}));
 	core->add_instruction(create_def<GeReal>("ge", {"real", "real"}, {"bool"}));
 
+	core->add_instruction(create_def<AddReal>("add", {"real32", "real32"}, {"real32"}));
+	core->add_instruction(create_def<SubReal>("sub", {"real32", "real32"}, {"real32"}));
+	core->add_instruction(create_def<MulReal>("mul", {"real32", "real32"}, {"real32"}));
+	core->add_instruction(create_def<DivReal>("div", {"real32", "real32"}, {"real32"}));
+	core->add_instruction(create_def<PowReal>("pow", {"real32", "real32"}, {"real32"}));
+	core->add_instruction(create_def<EqReal>("eq", {"real32", "real32"}, {"bool"}));
+	core->add_instruction(create_def<NeReal>("ne", {"real32", "real32"}, {"bool"}));
+	core->add_instruction(create_def<LtReal>("lt", {"real32", "real32"}, {"bool"}));
+	core->add_instruction(create_def<LeReal>("le", {"real32", "real32"}, {"bool"}));
+	core->add_instruction(create_def<GtReal>("gt", {"real32", "real32"}, {"bool"}));
+	core->add_instruction(create_def<GeReal>("ge", {"real32", "real32"}, {"bool"}));
+	//literals are real, mixing precisions needs one of these
+	core->add_instruction(create_def<ConvertReal>("real32", {"real"}, {"real32"}));
+	core->add_instruction(create_def<ConvertReal>("real", {"real32"}, {"real"}));
+
+	//vecN.real, the lexer won't take the dot in an annotation so these are
+	//spelled vec2, vec4 and vec8 in programs
+	for(uint32_t width: {2, 4, 8})
+	{
+		auto short_name = "vec" + std::to_string(width);
+		auto vec = short_name + ".real";
+		core->add_type(vec, std::make_unique<Vector>(core->type("real"), width));
+		core->add_type_alias(short_name, core->type(vec));
+		core->add_instruction(create_def<AddReal>("add", {vec, vec}, {vec}));
+		core->add_instruction(create_def<SubReal>("sub", {vec, vec}, {vec}));
+		core->add_instruction(create_def<MulReal>("mul", {vec, vec}, {vec}));
+		core->add_instruction(create_def<DivReal>("div", {vec, vec}, {vec}));
+		core->add_instruction(create_def<PowReal>("pow", {vec, vec}, {vec}));
+		core->add_instruction(create_def<VectorBuild>(short_name, {"real"}, {vec}));
+		core->add_instruction(create_def<VectorBuild>(short_name,
+													  std::vector<std::string>(width, "real"),
+													  {vec}));
+		core->add_instruction(create_def<VectorExtract>("extract", {vec, "real"}, {"real"}));
+		core->add_instruction(create_def<VectorExtract>("extract", {vec, "int"}, {"real"}));
+	}
+
+	core->add_instruction(create_def<AddInt>("add", {"int", "int"}, {"int"}));
+	core->add_instruction(create_def<SubInt>("sub", {"int", "int"}, {"int"}));
+	core->add_instruction(create_def<MulInt>("mul", {"int", "int"}, {"int"}));
+	core->add_instruction(create_def<DivInt>("div", {"int", "int"}, {"int"}));
+	core->add_instruction(create_def<ModInt>("mod", {"int", "int"}, {"int"}));
+	core->add_instruction(create_def<AndInt>("band", {"int", "int"}, {"int"}));
+	core->add_instruction(create_def<OrInt>("bor", {"int", "int"}, {"int"}));
+	core->add_instruction(create_def<XorInt>("bxor", {"int", "int"}, {"int"}));
+	core->add_instruction(create_def<ShlInt>("shl", {"int", "int"}, {"int"}));
+	core->add_instruction(create_def<ShrInt>("shr", {"int", "int"}, {"int"}));
+	core->add_instruction(create_def<EqInt>("eq", {"int", "int"}, {"bool"}));
+	core->add_instruction(create_def<NeInt>("ne", {"int", "int"}, {"bool"}));
+	core->add_instruction(create_def<LtInt>("lt", {"int", "int"}, {"bool"}));
+	core->add_instruction(create_def<LeInt>("le", {"int", "int"}, {"bool"}));
+	core->add_instruction(create_def<GtInt>("gt", {"int", "int"}, {"bool"}));
+	core->add_instruction(create_def<GeInt>("ge", {"int", "int"}, {"bool"}));
+
+	core->add_instruction(std::make_unique<ArrayArithmeticDefinition>("add", ArrayOp::Add));
+	core->add_instruction(std::make_unique<ArrayArithmeticDefinition>("sub", ArrayOp::Sub));
+	core->add_instruction(std::make_unique<ArrayArithmeticDefinition>("mul", ArrayOp::Mul));
+	core->add_instruction(std::make_unique<ArrayArithmeticDefinition>("div", ArrayOp::Div));
+	core->add_instruction(std::make_unique<ArrayArithmeticDefinition>("eq", ArrayOp::Eq));
+	core->add_instruction(std::make_unique<ArrayArithmeticDefinition>("ne", ArrayOp::Ne));
+	core->add_instruction(std::make_unique<ArrayArithmeticDefinition>("lt", ArrayOp::Lt));
+	core->add_instruction(std::make_unique<ArrayArithmeticDefinition>("le", ArrayOp::Le));
+	core->add_instruction(std::make_unique<ArrayArithmeticDefinition>("gt", ArrayOp::Gt));
+	core->add_instruction(std::make_unique<ArrayArithmeticDefinition>("ge", ArrayOp::Ge));
+	core->add_instruction(std::make_unique<ArrayReduceDefinition>("sum", 1));
+	core->add_instruction(std::make_unique<ArrayReduceDefinition>("min", 1));
+	core->add_instruction(std::make_unique<ArrayReduceDefinition>("max", 1));
+	core->add_instruction(std::make_unique<ArrayReduceDefinition>("mean", 1));
+	core->add_instruction(std::make_unique<ArrayReduceDefinition>("dot", 2));
+
 	//TODO create custom instruction builders for our control flow and debug operations.
 	core->add_instruction(create_def<Trace>("trace", {"real"}, {"unit"}));
 	core->add_instruction(create_def<Trace>("trace", {"string"}, {"unit"}));
 
-	core->add_instruction(create_def<Schedule>("schedule_absolute", {"int"}, {"unit"}));
+	core->add_instruction(create_def<Schedule>("schedule_absolute", {"int"}, {"unit", "int"}));
+	core->add_instruction(create_def<SchedulePeriodic>("schedule_periodic", {"int"}, {"unit"}));
 
 	core->add_instruction(std::make_unique<ArrayBuilderDefinition>());
 	//bang is handled like value constructors in the sematic layer since it has no inputs
@@ -113,6 +184,8 @@ void World::create_core_namespace()
 	core->add_instruction(std::make_unique<MergeDefinition>());
 	core->add_instruction(std::make_unique<SeqDefinition>());
 	core->add_instruction(std::make_unique<DelayDefinition>());
+	core->add_instruction(std::make_unique<DelayLineDefinition>());
+	core->add_instruction(create_def<Counter>("counter", {"real"}, {"real"}));
 
 
 	add_external(std::make_unique<ExternalDefinition>
@@ -125,11 +198,30 @@ void World::create_core_namespace()
 				 ("print", std::vector<Type*>{core->type("opaque")},
 				  core->type("unit"), "", (void*)&xerxzema_print, true));
 
+	add_external(std::make_unique<ExternalDefinition>
+				 ("trace_real", std::vector<Type*>{core->type("int"), core->type("real")},
+				  core->type("unit"), "", (void*)&xerxzema_trace_real));
+
+	add_external(std::make_unique<ExternalDefinition>
+				 ("trace_string", std::vector<Type*>{core->type("int"), core->type("opaque"),
+						 core->type("int")},
+				  core->type("unit"), "", (void*)&xerxzema_trace_string));
+
 	//TODO add a proper c function type maybe?
 	add_external(std::make_unique<ExternalDefinition>
 				 ("schedule", std::vector<Type*>{core->type("opaque"), core->type("opaque"),
 						 core->type("opaque"), core->type("int")},
-				  core->type("unit"), "", (void*)&xerxzema_schedule));
+				  core->type("int"), "", (void*)&xerxzema_schedule));
+
+	add_external(std::make_unique<ExternalDefinition>
+				 ("schedule_periodic", std::vector<Type*>{core->type("opaque"),
+						 core->type("opaque"), core->type("opaque"), core->type("int"),
+						 core->type("int")},
+				  core->type("unit"), "", (void*)&xerxzema_schedule_periodic));
+
+	add_external(std::make_unique<ExternalDefinition>
+				 ("cancel_state", std::vector<Type*>{core->type("opaque"), core->type("opaque")},
+				  core->type("unit"), "", (void*)&xerxzema_cancel_state));
 
 	add_external(std::make_unique<ExternalDefinition>
 				 ("malloc", std::vector<Type*>{core->type("int")},
@@ -139,12 +231,63 @@ void World::create_core_namespace()
 				 ("free", std::vector<Type*>{core->type("opaque")},
 				  core->type("unit"), "", (void*)&trace_free));
 
+	add_external(std::make_unique<ExternalDefinition>
+				 ("array_reserve", std::vector<Type*>{core->type("opaque"), core->type("int"),
+						 core->type("int")},
+				  core->type("opaque"), "", (void*)&xerxzema_array_reserve));
+
+	add_external(std::make_unique<ExternalDefinition>
+				 ("array_retain", std::vector<Type*>{core->type("opaque")},
+				  core->type("unit"), "", (void*)&xerxzema_array_retain));
+
+	add_external(std::make_unique<ExternalDefinition>
+				 ("array_release", std::vector<Type*>{core->type("opaque")},
+				  core->type("unit"), "", (void*)&xerxzema_array_release));
+
+	add_external(std::make_unique<ExternalDefinition>
+				 ("delay_grow", std::vector<Type*>{core->type("opaque"), core->type("int")},
+				  core->type("unit"), "", (void*)&xerxzema_delay_grow));
+
+	add_external(std::make_unique<ExternalDefinition>
+				 ("array_sum", std::vector<Type*>{core->type("opaque"), core->type("int")},
+				  core->type("real"), "", (void*)&xerxzema_array_sum));
+
+	add_external(std::make_unique<ExternalDefinition>
+				 ("array_min", std::vector<Type*>{core->type("opaque"), core->type("int")},
+				  core->type("real"), "", (void*)&xerxzema_array_min));
+
+	add_external(std::make_unique<ExternalDefinition>
+				 ("array_max", std::vector<Type*>{core->type("opaque"), core->type("int")},
+				  core->type("real"), "", (void*)&xerxzema_array_max));
+
+	add_external(std::make_unique<ExternalDefinition>
+				 ("array_mean", std::vector<Type*>{core->type("opaque"), core->type("int")},
+				  core->type("real"), "", (void*)&xerxzema_array_mean));
+
+	add_external(std::make_unique<ExternalDefinition>
+				 ("array_dot", std::vector<Type*>{core->type("opaque"), core->type("opaque"),
+						 core->type("int")},
+				  core->type("real"), "", (void*)&xerxzema_array_dot));
+
 	core->add_external_mapping(externals["xerxzema.print"].get());
+	core->add_external_mapping(externals["xerxzema.trace_real"].get());
+	core->add_external_mapping(externals["xerxzema.trace_string"].get());
 	core->add_external_mapping(externals["xerxzema.scheduler"].get());
 	core->add_external_mapping(externals["xerxzema.jit"].get());
 	core->add_external_mapping(externals["xerxzema.schedule"].get());
+	core->add_external_mapping(externals["xerxzema.schedule_periodic"].get());
+	core->add_external_mapping(externals["xerxzema.cancel_state"].get());
 	core->add_external_mapping(externals["xerxzema.malloc"].get());
 	core->add_external_mapping(externals["xerxzema.free"].get());
+	core->add_external_mapping(externals["xerxzema.array_reserve"].get());
+	core->add_external_mapping(externals["xerxzema.array_retain"].get());
+	core->add_external_mapping(externals["xerxzema.array_release"].get());
+	core->add_external_mapping(externals["xerxzema.delay_grow"].get());
+	core->add_external_mapping(externals["xerxzema.array_sum"].get());
+	core->add_external_mapping(externals["xerxzema.array_min"].get());
+	core->add_external_mapping(externals["xerxzema.array_max"].get());
+	core->add_external_mapping(externals["xerxzema.array_mean"].get());
+	core->add_external_mapping(externals["xerxzema.array_dot"].get());
 
 	namespaces.emplace("core", std::move(core));
 
@@ -42,6 +42,7 @@ public:
 	ExternalDefinition* get_external(const std::string& name);
 	Jit* jit();
 	inline Scheduler* scheduler() { return _scheduler.get(); }
+	inline SchedulerMetrics& scheduler_metrics() { return _scheduler->metrics(); }
 private:
 	void create_core_namespace();
 	std::map<std::string, std::unique_ptr<Namespace>> namespaces;
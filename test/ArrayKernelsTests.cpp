@@ -0,0 +1,68 @@
+#include <gtest/gtest.h>
+#include "../lib/ArrayKernels.h"
+#include <cmath>
+#include <vector>
+
+static std::vector<double> make_data(size_t size)
+{
+	std::vector<double> data(size);
+	for(size_t i = 0; i < size; i++)
+		data[i] = std::sin(i * 0.37) * 1e3 + 1.0 / (i + 1);
+	return data;
+}
+
+TEST(TestArrayKernels, TestSmall)
+{
+	std::vector<double> data{3, -1, 4, 1, 5, 9, 2, 6, 5, 3, 5};
+	ASSERT_EQ(xerxzema::array_sum(data.data(), data.size()), 42);
+	ASSERT_EQ(xerxzema::array_min(data.data(), data.size()), -1);
+	ASSERT_EQ(xerxzema::array_max(data.data(), data.size()), 9);
+	ASSERT_EQ(xerxzema::array_dot(data.data(), data.data(), data.size()), 232);
+	ASSERT_EQ(xerxzema::array_mean(data.data(), 2), 1);
+}
+
+TEST(TestArrayKernels, TestEmpty)
+{
+	ASSERT_EQ(xerxzema::array_sum(nullptr, 0), 0);
+	ASSERT_EQ(xerxzema::array_dot(nullptr, nullptr, 0), 0);
+	ASSERT_EQ(xerxzema::array_min(nullptr, 0), INFINITY);
+	ASSERT_EQ(xerxzema::array_max(nullptr, 0), -INFINITY);
+	ASSERT_TRUE(std::isnan(xerxzema::array_mean(nullptr, 0)));
+}
+
+TEST(TestArrayKernels, TestParallelIsDeterministic)
+{
+	auto data = make_data(1000003);
+	auto old_threshold = xerxzema::parallel_threshold();
+
+	xerxzema::parallel_threshold(INT64_MAX);
+	auto serial_sum = xerxzema::array_sum(data.data(), data.size());
+	auto serial_dot = xerxzema::array_dot(data.data(), data.data(), data.size());
+	auto serial_min = xerxzema::array_min(data.data(), data.size());
+
+	xerxzema::parallel_threshold(0);
+	for(int i = 0; i < 10; i++)
+	{
+		ASSERT_EQ(xerxzema::array_sum(data.data(), data.size()), serial_sum);
+		ASSERT_EQ(xerxzema::array_dot(data.data(), data.data(), data.size()), serial_dot);
+		ASSERT_EQ(xerxzema::array_min(data.data(), data.size()), serial_min);
+	}
+	xerxzema::parallel_threshold(old_threshold);
+
+	double naive = 0;
+	for(auto v: data)
+		naive += v;
+	ASSERT_NEAR(serial_sum, naive, 1e-6 * std::fabs(naive));
+}
+
+TEST(TestArrayKernels, TestWorkerPool)
+{
+	xerxzema::WorkerPool pool(3);
+	std::vector<int> hits(1000, 0);
+	for(int round = 0; round < 20; round++)
+	{
+		pool.run(hits.size(), [&](size_t i) { hits[i]++; });
+	}
+	for(auto h: hits)
+		ASSERT_EQ(h, 20);
+}
@@ -0,0 +1,117 @@
+#include <gtest/gtest.h>
+#include "../lib/ArrayStorage.h"
+
+static xerxzema::ArrayValue empty_array()
+{
+	return xerxzema::ArrayValue{nullptr, 0, 0, {}};
+}
+
+TEST(TestArrayStorage, TestReserveReuses)
+{
+	auto a = empty_array();
+	auto data = (double*)xerxzema::array_reserve(&a, 8, sizeof(double));
+	ASSERT_EQ(a.size, 8);
+	ASSERT_EQ(a.alloc, 8);
+	ASSERT_EQ(xerxzema::array_refs(&a), 1);
+
+	//shrinking and growing back inside the capacity keeps the buffer
+	ASSERT_EQ(xerxzema::array_reserve(&a, 3, sizeof(double)), data);
+	ASSERT_EQ(a.size, 3);
+	ASSERT_EQ(xerxzema::array_reserve(&a, 8, sizeof(double)), data);
+
+	xerxzema::array_release(&a);
+	ASSERT_EQ(a.data, nullptr);
+	ASSERT_EQ(a.alloc, 0);
+	ASSERT_EQ(xerxzema::array_refs(&a), 0);
+}
+
+TEST(TestArrayStorage, TestCopyOnWrite)
+{
+	auto a = empty_array();
+	auto data = (double*)xerxzema::array_reserve(&a, 4, sizeof(double));
+	for(int i = 0; i < 4; i++)
+		data[i] = i;
+
+	auto b = a;
+	xerxzema::array_retain(&b);
+	ASSERT_EQ(xerxzema::array_refs(&a), 2);
+
+	//writing through b must not show up in a
+	auto b_data = (double*)xerxzema::array_make_unique(&b, sizeof(double));
+	ASSERT_NE(b_data, data);
+	ASSERT_EQ(xerxzema::array_refs(&a), 1);
+	ASSERT_EQ(xerxzema::array_refs(&b), 1);
+	b_data[0] = 42;
+	ASSERT_EQ(data[0], 0);
+	ASSERT_EQ(b_data[3], 3);
+
+	//a is the only owner again so it writes in place
+	ASSERT_EQ(xerxzema::array_make_unique(&a, sizeof(double)), data);
+
+	xerxzema::array_release(&a);
+	xerxzema::array_release(&b);
+}
+
+TEST(TestArrayStorage, TestReserveShared)
+{
+	auto a = empty_array();
+	auto data = xerxzema::array_reserve(&a, 4, sizeof(double));
+	auto b = a;
+	xerxzema::array_retain(&b);
+
+	ASSERT_NE(xerxzema::array_reserve(&b, 2, sizeof(double)), data);
+	ASSERT_EQ(a.data, data);
+	ASSERT_EQ(a.size, 4);
+	ASSERT_EQ(xerxzema::array_refs(&a), 1);
+
+	xerxzema::array_release(&a);
+	xerxzema::array_release(&b);
+}
+
+TEST(TestArrayStorage, TestInline)
+{
+	auto a = empty_array();
+	auto data = (double*)xerxzema::array_reserve(&a, 2, sizeof(double));
+	ASSERT_EQ((void*)data, (void*)a.inline_data);
+	ASSERT_EQ(a.alloc, xerxzema::array_inline);
+	ASSERT_EQ(xerxzema::array_refs(&a), 0);
+	data[0] = 1;
+	data[1] = 2;
+
+	//a copied struct gets pointed back at its own storage
+	auto b = a;
+	auto b_data = (double*)xerxzema::array_make_unique(&b, sizeof(double));
+	ASSERT_EQ((void*)b_data, (void*)b.inline_data);
+	b_data[0] = 42;
+	ASSERT_EQ(data[0], 1);
+	ASSERT_EQ(b_data[1], 2);
+
+	//growing past the inline storage moves to the heap
+	xerxzema::array_reserve(&a, 3, sizeof(double));
+	ASSERT_EQ(a.alloc, 3);
+	ASSERT_EQ(xerxzema::array_refs(&a), 1);
+	xerxzema::array_release(&a);
+	xerxzema::array_release(&b);
+}
+
+TEST(TestArrayStorage, TestAssign)
+{
+	auto a = empty_array();
+	auto data = (double*)xerxzema::array_reserve(&a, 2, sizeof(double));
+	data[0] = 1;
+	data[1] = 2;
+
+	xerxzema::ArrayValue b;
+	xerxzema::array_assign(&b, a);
+	ASSERT_EQ(b.data, (void*)b.inline_data);
+	ASSERT_EQ(((double*)b.data)[1], 2);
+
+	//heap buffers are shared as is
+	auto c = empty_array();
+	auto c_data = xerxzema::array_reserve(&c, 5, sizeof(double));
+	xerxzema::ArrayValue d;
+	xerxzema::array_assign(&d, c);
+	ASSERT_EQ(d.data, c_data);
+	ASSERT_EQ(xerxzema::array_refs(&c), 1);
+	xerxzema::array_release(&c);
+}
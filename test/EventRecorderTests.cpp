@@ -0,0 +1,95 @@
+#include <gtest/gtest.h>
+#include <stdio.h>
+#include <vector>
+#include "../lib/Scheduler.h"
+#include "../lib/EventRecorder.h"
+
+struct RecordedChain
+{
+	xerxzema::CallbackState header;
+	xerxzema::Scheduler* scheduler;
+	int remaining;
+};
+
+static void chain_callback(void* state)
+{
+	auto s = (RecordedChain*)state;
+	if(--s->remaining > 0)
+		s->scheduler->schedule(chain_callback, state, s->header.exec_time + 250);
+}
+
+static std::vector<uint64_t> replayed;
+
+static void replay_callback(void* state)
+{
+	replayed.push_back(((xerxzema::CallbackState*)state)->exec_time);
+}
+
+TEST(TestEventRecorder, TestRecordReplay)
+{
+	auto file = tmpfile();
+	xerxzema::Scheduler scheduler;
+	xerxzema::EventRecorder recorder(file);
+	scheduler.record(&recorder);
+	scheduler.offline();
+
+	RecordedChain first{};
+	first.scheduler = &scheduler;
+	first.remaining = 4;
+	RecordedChain second{};
+	second.scheduler = &scheduler;
+	second.remaining = 2;
+	scheduler.schedule(chain_callback, &first, 1000);
+	scheduler.schedule(chain_callback, &second, 1100, xerxzema::SchedulerLane::Background);
+	scheduler.run();
+	scheduler.record(nullptr);
+	recorder.flush();
+	ASSERT_EQ(recorder.count(), 6u);
+
+	rewind(file);
+	xerxzema::EventReplay replay;
+	ASSERT_TRUE(replay.load(file));
+	ASSERT_EQ(replay.events().size(), 6u);
+	ASSERT_EQ(replay.callback_count(), 1u);
+	ASSERT_EQ(replay.state_count(), 2u);
+	ASSERT_EQ(replay.events()[1].lane, (uint8_t)xerxzema::SchedulerLane::Background);
+
+	//shifted to start at 0, the chains were submitted at virtual time 0
+	replay.callback(0, replay_callback);
+	xerxzema::Scheduler target;
+	target.offline();
+	replay.replay(&target, 0);
+	target.run();
+	ASSERT_EQ(replay.submitted(), 6u);
+	std::vector<uint64_t> expected = {1000, 1100, 1250, 1350, 1500, 1750};
+	ASSERT_EQ(replayed, expected);
+	fclose(file);
+}
+
+TEST(TestEventRecorder, TestOverflow)
+{
+	auto file = tmpfile();
+	xerxzema::EventRecorder recorder(file, false);
+	xerxzema::CallbackData task{};
+	for(uint64_t i = 0; i < xerxzema::recorder_capacity + 10; i++)
+		recorder.record(task, i);
+	ASSERT_EQ(recorder.dropped(), 10u);
+	recorder.flush();
+	ASSERT_EQ(recorder.count(), xerxzema::recorder_capacity);
+
+	//flushing makes room again
+	recorder.record(task, 0);
+	recorder.flush();
+	ASSERT_EQ(recorder.count(), xerxzema::recorder_capacity + 1);
+	fclose(file);
+}
+
+TEST(TestEventRecorder, TestBadFile)
+{
+	auto file = tmpfile();
+	fputs("not a recording", file);
+	rewind(file);
+	xerxzema::EventReplay replay;
+	ASSERT_FALSE(replay.load(file));
+	fclose(file);
+}
@@ -0,0 +1,35 @@
+#include <gtest/gtest.h>
+#include "../lib/Histogram.h"
+
+TEST(TestHistogram, TestBuckets)
+{
+	//every bucket starts right after the previous one ends
+	for(size_t i = 1; i < xerxzema::histogram_buckets; i++)
+	{
+		auto low = xerxzema::Histogram::bucket_high(i - 1) + 1;
+		ASSERT_EQ(xerxzema::Histogram::bucket(low), i);
+		ASSERT_EQ(xerxzema::Histogram::bucket(xerxzema::Histogram::bucket_high(i)), i);
+	}
+	ASSERT_EQ(xerxzema::Histogram::bucket(UINT64_MAX), xerxzema::histogram_buckets - 1);
+}
+
+TEST(TestHistogram, TestPercentiles)
+{
+	xerxzema::Histogram h;
+	ASSERT_EQ(h.percentile(50), 0u);
+	for(uint64_t i = 1; i <= 1000; i++)
+		h.record(i * 1000);
+
+	ASSERT_EQ(h.count(), 1000u);
+	ASSERT_EQ(h.min(), 1000u);
+	ASSERT_EQ(h.max(), 1000000u);
+	ASSERT_DOUBLE_EQ(h.mean(), 500500);
+	//within the bucket precision
+	ASSERT_NEAR(h.percentile(50), 500000, 500000 / 32);
+	ASSERT_NEAR(h.percentile(99), 990000, 990000 / 32);
+	ASSERT_EQ(h.percentile(100), 1000000u);
+
+	h.reset();
+	ASSERT_EQ(h.count(), 0u);
+	ASSERT_EQ(h.max(), 0u);
+}
@@ -3,6 +3,7 @@
 #include "../lib/Instruction.h"
 #include "../lib/Diagnostics.h"
 #include "../lib/JitInvoke.h"
+#include "../lib/ArrayStorage.h"
 #include "../lib/Session.h"
 #include "../lib/Parser.h"
 #include <stdio.h>
@@ -84,6 +85,59 @@ TEST(TestJit, TestDelay)
 	}
 }
 
+TEST(TestJit, TestDelayLine)
+{
+	xerxzema::World world;
+	auto ns = world.get_namespace("test");
+	auto program_str =
+R"EOF(
+prog fixed(x:real) -> y:real
+{
+	delay(x, 3.0) -> y;
+}
+prog between(x:real) -> y:real
+{
+	delay(x, 1.5) -> y;
+}
+prog varying(x:real, n:real) -> y:real
+{
+	delay(x, n) -> y;
+}
+)EOF";
+	xerxzema::parse_input(program_str, ns);
+	world.jit()->compile_namespace(ns);
+
+	xerxzema::JitInvoke<double, double> fixed(world.jit(), ns->get_program("fixed"));
+	xerxzema::JitInvoke<double, double> between(world.jit(), ns->get_program("between"));
+	for(int i = 0; i < 40; i++)
+	{
+		ASSERT_EQ(fixed(i + 1), i < 3 ? 0 : i - 2);
+		ASSERT_EQ(between(i + 1), i < 2 ? (i == 1 ? 0.5 : 0) : i - 0.5);
+	}
+
+	//the jump to 20 grows the ring, what was written before has to survive it
+	xerxzema::JitInvoke<double, double, double> varying(world.jit(), ns->get_program("varying"));
+	for(int i = 0; i < 10; i++)
+		ASSERT_EQ(varying(i + 1, 2), i < 2 ? 0 : i - 1);
+	for(int i = 10; i < 40; i++)
+		ASSERT_EQ(varying(i + 1, 20), i < 20 ? 0 : i - 19);
+}
+
+TEST(TestJit, TestDelayLineInt)
+{
+	xerxzema::World world;
+	auto core = world.get_namespace("core");
+	auto p = core->get_program("test");
+	p->add_input("x", core->type("real"));
+	p->add_output("y", core->type("real"));
+	p->instruction("delay", {p->reg_data("x"), p->constant_int(2)}, {p->reg_data("y")});
+	world.jit()->compile_namespace(core);
+
+	xerxzema::JitInvoke<double, double> invoker(world.jit(), p);
+	for(int i = 0; i < 20; i++)
+		ASSERT_EQ(invoker(i + 1), i < 2 ? 0 : i - 1);
+}
+
 TEST(TestJit, TestWhenVerboseSyntax)
 {
 
@@ -158,6 +212,375 @@ TEST(TestJit, TestPow)
 	ASSERT_EQ(invoker(2), 4);
 }
 
+TEST(TestJit, TestIntArithmetic)
+{
+	xerxzema::World world;
+	auto jit = world.jit();
+	auto program_str =
+R"EOF(
+prog foo(a:int, b:int) -> y:int
+{
+	(a * b + a - b) % 7 -> y;
+}
+prog bits(a:int, b:int) -> y:int
+{
+	bxor(bor(shl(a, b), shr(a, 1)), band(a, 12)) -> y;
+}
+prog quot(a:int, b:int) -> y:int
+{
+	a / b -> y;
+}
+)EOF";
+
+	auto ns = world.get_namespace("core");
+	xerxzema::parse_input(program_str, ns);
+	world.jit()->compile_namespace(ns);
+
+	xerxzema::JitInvoke<int64_t, int64_t, int64_t> invoker(jit, ns->get_program("foo"));
+	ASSERT_EQ(invoker(5, 3), 3);
+	ASSERT_EQ(invoker(-5, 3), -2);
+
+	xerxzema::JitInvoke<int64_t, int64_t, int64_t> bits(jit, ns->get_program("bits"));
+	ASSERT_EQ(bits(6, 2), ((6 << 2) | (6 >> 1)) ^ (6 & 12));
+	ASSERT_EQ(bits(1, 65), 2);
+
+	xerxzema::JitInvoke<int64_t, int64_t, int64_t> quot(jit, ns->get_program("quot"));
+	ASSERT_EQ(quot(7, -2), -3);
+	ASSERT_EQ(quot(7, 0), 0);
+	ASSERT_EQ(quot(INT64_MIN, -1), INT64_MIN);
+}
+
+TEST(TestJit, TestIntCompare)
+{
+	xerxzema::World world;
+	auto jit = world.jit();
+	auto program_str =
+R"EOF(
+prog foo(a:int, b:int) -> y:bool
+{
+	a < b -> y;
+}
+)EOF";
+
+	auto ns = world.get_namespace("core");
+	xerxzema::parse_input(program_str, ns);
+	world.jit()->compile_namespace(ns);
+
+	xerxzema::JitInvoke<bool, int64_t, int64_t> invoker(jit, ns->get_program("foo"));
+	ASSERT_TRUE(invoker(-9007199254740993, -9007199254740992));
+	ASSERT_FALSE(invoker(3, 3));
+}
+
+//mirrors the layout of array.T in the state struct. JitInvoke copies these in
+//and out of the state by value so copies go through array_assign.
+template<class T>
+struct TestArray
+{
+	TestArray(const xerxzema::ArrayValue& value)
+	{
+		xerxzema::array_assign(raw(), value);
+	}
+
+	TestArray(const TestArray& other)
+	{
+		xerxzema::array_assign(raw(), *other.raw());
+	}
+
+	TestArray& operator=(const TestArray& other)
+	{
+		xerxzema::array_assign(raw(), *other.raw());
+		return *this;
+	}
+
+	xerxzema::ArrayValue* raw()
+	{
+		return (xerxzema::ArrayValue*)this;
+	}
+
+	const xerxzema::ArrayValue* raw() const
+	{
+		return (const xerxzema::ArrayValue*)this;
+	}
+
+	T* data;
+	int64_t size;
+	int64_t alloc;
+	uint8_t inline_data[xerxzema::array_inline_bytes];
+};
+
+//the program destructor releases whatever is in its array registers so these
+//have to come from the array runtime
+static TestArray<double> make_real_array(int64_t size, double start, double step)
+{
+	xerxzema::ArrayValue value{nullptr, 0, 0};
+	auto data = (double*)xerxzema::array_reserve(&value, size, sizeof(double));
+	for(int64_t i = 0; i < size; i++)
+		data[i] = start + i * step;
+	return TestArray<double>(value);
+}
+
+TEST(TestJit, TestArrayRealArithmetic)
+{
+	xerxzema::World world;
+	auto core = world.get_namespace("core");
+	auto array_real = core->type("array", {core->type("real")});
+	auto p = core->get_program("test");
+	p->add_input("a", array_real);
+	p->add_input("b", array_real);
+	p->add_output("y", array_real);
+	p->instruction("mul", {"a", "b"}, {"y"});
+	world.jit()->compile_namespace(core);
+
+	//19 elements covers two vector iterations and a scalar tail,
+	//the output is cut down to the shorter input
+	xerxzema::JitInvoke<TestArray<double>, TestArray<double>, TestArray<double>>
+		invoker(world.jit(), p);
+	auto y = invoker(make_real_array(19, 0, 1), make_real_array(20, 1, 0.5));
+	ASSERT_EQ(y.size, 19);
+	for(int64_t i = 0; i < y.size; i++)
+		ASSERT_EQ(y.data[i], i * (1 + i * 0.5));
+}
+
+TEST(TestJit, TestArrayScalarArithmetic)
+{
+	xerxzema::World world;
+	auto core = world.get_namespace("core");
+	auto array_real = core->type("array", {core->type("real")});
+	auto p = core->get_program("test");
+	p->add_input("a", array_real);
+	p->add_input("s", core->type("real"));
+	p->add_output("y", array_real);
+	p->instruction("sub", {"a", "s"}, {"y"});
+	world.jit()->compile_namespace(core);
+
+	xerxzema::JitInvoke<TestArray<double>, TestArray<double>, double> invoker(world.jit(), p);
+	auto y = invoker(make_real_array(13, 0, 2), 1.5);
+	ASSERT_EQ(y.size, 13);
+	for(int64_t i = 0; i < y.size; i++)
+		ASSERT_EQ(y.data[i], i * 2 - 1.5);
+}
+
+TEST(TestJit, TestArrayCompare)
+{
+	xerxzema::World world;
+	auto core = world.get_namespace("core");
+	auto array_real = core->type("array", {core->type("real")});
+	auto p = core->get_program("test");
+	p->add_input("a", array_real);
+	p->add_input("s", core->type("real"));
+	p->add_output("y", core->type("array", {core->type("bool")}));
+	p->instruction("lt", {"a", "s"}, {"y"});
+	world.jit()->compile_namespace(core);
+
+	xerxzema::JitInvoke<TestArray<bool>, TestArray<double>, double> invoker(world.jit(), p);
+	auto y = invoker(make_real_array(17, 0, 1), 9.5);
+	ASSERT_EQ(y.size, 17);
+	for(int64_t i = 0; i < y.size; i++)
+		ASSERT_EQ(y.data[i], i < 9.5);
+}
+
+TEST(TestJit, TestArrayShared)
+{
+	xerxzema::World world;
+	auto core = world.get_namespace("core");
+	auto array_real = core->type("array", {core->type("real")});
+	auto p = core->get_program("test");
+	p->add_input("a", array_real);
+	p->add_input("b", array_real);
+	p->add_output("y", array_real);
+	p->instruction("merge", {"a", "b"}, {"y"});
+	world.jit()->compile_namespace(core);
+
+	//the output shares the input buffer instead of getting a copy of it
+	xerxzema::JitInvoke<TestArray<double>, TestArray<double>, TestArray<double>>
+		invoker(world.jit(), p);
+	for(int i = 0; i < 3; i++)
+	{
+		auto a = make_real_array(100, i, 1);
+		auto y = invoker(a, make_real_array(10, 0, 0));
+		ASSERT_EQ(y.data, a.data);
+		ASSERT_EQ(y.size, 100);
+		ASSERT_EQ(xerxzema::array_refs((xerxzema::ArrayValue*)&y), 2);
+		ASSERT_EQ(y.data[99], i + 99);
+	}
+}
+
+TEST(TestJit, TestArrayInline)
+{
+	xerxzema::World world;
+	auto core = world.get_namespace("core");
+	auto array_real = core->type("array", {core->type("real")});
+	auto p = core->get_program("test");
+	p->add_input("a", array_real);
+	p->add_input("s", core->type("real"));
+	p->add_output("y", array_real);
+	p->instruction("mul", {"a", "s"}, {"y"});
+	world.jit()->compile_namespace(core);
+
+	//two doubles fit in the register, bigger results go to the heap
+	xerxzema::JitInvoke<TestArray<double>, TestArray<double>, double> invoker(world.jit(), p);
+	auto y = invoker(make_real_array(2, 1, 1), 3);
+	ASSERT_EQ(y.alloc, xerxzema::array_inline);
+	ASSERT_EQ(y.data[0], 3);
+	ASSERT_EQ(y.data[1], 6);
+
+	y = invoker(make_real_array(5, 1, 1), 2);
+	ASSERT_EQ(y.alloc, 5);
+	ASSERT_EQ(y.data[4], 10);
+}
+
+TEST(TestJit, TestReal32)
+{
+	xerxzema::World world;
+	auto ns = world.get_namespace("test");
+	auto program_str =
+R"EOF(
+prog foo(x:real) -> y:real
+{
+	real32(x) -> a;
+	a * a + real32(0.5) -> b;
+	real(b) -> y;
+}
+)EOF";
+	xerxzema::parse_input(program_str, ns);
+	world.jit()->compile_namespace(ns);
+
+	xerxzema::JitInvoke<double, double> invoker(world.jit(), ns->get_program("foo"));
+	float a = 0.1f;
+	ASSERT_FLOAT_EQ(invoker(0.1), a * a + 0.5f);
+	ASSERT_NE(invoker(0.1), 0.1 * 0.1 + 0.5);
+}
+
+TEST(TestJit, TestArrayReal32)
+{
+	xerxzema::World world;
+	auto core = world.get_namespace("core");
+	auto real32 = core->type("real32");
+	auto array_real32 = core->type("array", {real32});
+	auto p = core->get_program("test");
+	p->add_input("a", array_real32);
+	p->add_input("s", real32);
+	p->add_output("y", array_real32);
+	p->instruction("mul", {"a", "s"}, {"y"});
+	world.jit()->compile_namespace(core);
+
+	//past one 16 wide vector so the scalar tail runs too
+	xerxzema::ArrayValue value{nullptr, 0, 0};
+	auto data = (float*)xerxzema::array_reserve(&value, 19, sizeof(float));
+	for(int64_t i = 0; i < 19; i++)
+		data[i] = i;
+	TestArray<float> a(value);
+
+	xerxzema::JitInvoke<TestArray<float>, TestArray<float>, float> invoker(world.jit(), p);
+	auto y = invoker(a, 0.5f);
+	ASSERT_EQ(y.size, 19);
+	for(int64_t i = 0; i < y.size; i++)
+		ASSERT_EQ(y.data[i], i * 0.5f);
+}
+
+TEST(TestJit, TestVector)
+{
+	xerxzema::World world;
+	auto ns = world.get_namespace("test");
+	auto program_str =
+R"EOF(
+prog foo(x:real) -> y:real
+{
+	vec4(x, 2.0, 3.0, 4.0) -> a;
+	shuffle(a + vec4(1.0), 3, 2, 1, 0) -> b;
+	b * a -> c;
+	extract(c, 0) + extract(c, 3) + extract(shuffle(c, 1, 2), 1) -> y;
+}
+)EOF";
+	xerxzema::parse_input(program_str, ns);
+	world.jit()->compile_namespace(ns);
+
+	//a = [x 2 3 4], b = [5 4 3 x+1], c = [5x 8 9 4x+4]
+	xerxzema::JitInvoke<double, double> invoker(world.jit(), ns->get_program("foo"));
+	ASSERT_EQ(invoker(1), 5 + 8 + 9);
+	ASSERT_EQ(invoker(2), 10 + 12 + 9);
+}
+
+TEST(TestJit, TestArrayReduce)
+{
+	xerxzema::World world;
+	auto ns = world.get_namespace("test");
+	auto program_str =
+R"EOF(
+prog foo(n:real) -> y:real
+{
+	[n, 2.0, 3.0, 4.0] -> xs;
+	sum(xs) + dot(xs, xs) + max(xs) - min(xs) -> y;
+}
+)EOF";
+	xerxzema::parse_input(program_str, ns);
+	world.jit()->compile_namespace(ns);
+
+	xerxzema::JitInvoke<double, double> invoker(world.jit(), ns->get_program("foo"));
+	ASSERT_EQ(invoker(1), 43);
+}
+
+TEST(TestJit, TestMapFold)
+{
+	xerxzema::World world;
+	auto ns = world.get_namespace("test");
+	auto program_str =
+R"EOF(
+prog square(x:real) -> y:real
+{
+	x * x -> y;
+}
+prog accumulate(a:real, x:real) -> y:real
+{
+	a + x -> y;
+}
+prog foo(n:real) -> y:real
+{
+	[n, 2.0, 3.0] -> xs;
+	fold(accumulate, 0.5, map(square, xs)) -> y;
+}
+)EOF";
+	xerxzema::parse_input(program_str, ns);
+	world.jit()->compile_namespace(ns);
+
+	xerxzema::JitInvoke<double, double> invoker(world.jit(), ns->get_program("foo"));
+	ASSERT_EQ(invoker(1), 14.5);
+}
+
+TEST(TestJit, TestUgenBlock)
+{
+	xerxzema::World world;
+	auto ns = world.get_namespace("test");
+	auto program_str =
+R"EOF(
+ugen ramp(step:real) -> out:real
+{
+	1.0 + 0.5 * counter(step) -> out;
+}
+prog ramp_sample(step:real) -> out:real
+{
+	1.0 + 0.5 * counter(step) -> out;
+}
+)EOF";
+	xerxzema::parse_input(program_str, ns);
+	auto block = ns->get_program("ramp");
+	auto sample = ns->get_program("ramp_sample");
+	ASSERT_EQ(block->block_size(), xerxzema::Program::default_block_size);
+	ASSERT_EQ(sample->block_size(), 0u);
+	world.jit()->compile_namespace(ns);
+
+	//two blocks have to line up with 128 single sample activations
+	xerxzema::JitInvoke<TestArray<double>, double> block_invoker(world.jit(), block);
+	xerxzema::JitInvoke<double, double> sample_invoker(world.jit(), sample);
+	for(int b = 0; b < 2; b++)
+	{
+		auto y = block_invoker(0.125);
+		ASSERT_EQ(y.size, block->block_size());
+		for(int64_t i = 0; i < y.size; i++)
+			ASSERT_EQ(y.data[i], sample_invoker(0.125));
+	}
+}
+
 TEST(TestJit, TestSchedulerCallback)
 {
 	xerxzema::World world;
@@ -181,6 +604,23 @@ TEST(TestJit, TestSchedulerCallback)
 	//change at all (scheduler based ones)
 }
 
+TEST(TestJit, TestScheduleStatus)
+{
+	xerxzema::World world;
+
+	auto p = world.get_namespace("core")->get_program("test");
+	p->add_input("i0", world.get_namespace("core")->type("real"));
+	p->add_output("status", world.get_namespace("core")->type("int"));
+
+	auto at_time = p->constant_int(20000000);
+	p->instruction("schedule_absolute", {at_time},
+				   {p->reg_data("run_it"), p->reg_data("status")});
+	auto jit = world.jit();
+	jit->compile_namespace(world.get_namespace("core"));
+	xerxzema::JitInvoke<int64_t, double> invoker(jit, p);
+	ASSERT_EQ(invoker(1), (int64_t)xerxzema::ScheduleStatus::Queued);
+}
+
 TEST(TestJit, TestSession)
 {
 	xerxzema::World world;
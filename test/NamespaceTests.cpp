@@ -26,6 +26,18 @@ TEST(TestNamespace, TestCoreTypes)
 	ASSERT_EQ(true, foo->is_type("unit"));
 }
 
+TEST(TestNamespace, TestArrayTypes)
+{
+	xerxzema::World world;
+	auto core = world.get_namespace("core");
+	auto reals = core->type("array", {core->type("real")});
+	ASSERT_NE(reals, nullptr);
+	ASSERT_EQ(reals->name(), "array.real");
+	//elements that need releasing aren't supported yet
+	ASSERT_EQ(core->type("array", {reals}), nullptr);
+	ASSERT_EQ(core->type("array", {core->type("string")}), nullptr);
+}
+
 TEST(TestNamespace, TestProgramCreation)
 {
 	xerxzema::World world;
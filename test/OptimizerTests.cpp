@@ -0,0 +1,422 @@
+#include <gtest/gtest.h>
+#include "../lib/World.h"
+#include "../lib/Instruction.h"
+#include "../lib/Optimizer.h"
+#include "../lib/JitInvoke.h"
+#include "../lib/Parser.h"
+#include <stdio.h>
+
+TEST(TestOptimizer, TestDeadTemporaries)
+{
+	xerxzema::World world;
+	auto ns = world.get_namespace("test");
+	auto program_str =
+R"EOF(
+prog foo(x:real) -> y:real
+{
+	x * 2.0 -> t;
+	x + x -> y;
+}
+)EOF";
+	xerxzema::parse_input(program_str, ns);
+	auto p = ns->get_program("foo");
+
+	xerxzema::Optimizer opt(p);
+	opt.eliminate_dead_instructions();
+
+	ASSERT_EQ(opt.get_dead_instruction_count(), 2);
+	ASSERT_EQ(p->instruction_listing().size(), 1);
+	ASSERT_EQ(p->instruction_listing()[0]->name(), "add");
+	ASSERT_EQ(p->reg("x")->activations.size(), 2);
+}
+
+TEST(TestOptimizer, TestKeepSideEffects)
+{
+	xerxzema::World world;
+	auto ns = world.get_namespace("test");
+	xerxzema::parse_input("12.0 -> x; trace(x);", ns);
+	auto p = ns->get_default_program();
+
+	xerxzema::Optimizer opt(p);
+	opt.eliminate_dead_instructions();
+
+	ASSERT_EQ(opt.get_dead_instruction_count(), 0);
+	ASSERT_EQ(p->instruction_listing().size(), 2);
+}
+
+TEST(TestOptimizer, TestTransientRegister)
+{
+	xerxzema::World world;
+	auto ns = world.get_namespace("test");
+	auto program_str =
+R"EOF(
+prog foo(x:real) -> y:real
+{
+	x * x -> t;
+	t * t -> y;
+}
+)EOF";
+	xerxzema::parse_input(program_str, ns);
+	auto p = ns->get_program("foo");
+
+	xerxzema::Optimizer opt(p);
+	opt.run();
+
+	ASSERT_EQ(opt.get_transient_register_count(), 1);
+	ASSERT_TRUE(p->reg("t")->is_transient());
+}
+
+TEST(TestOptimizer, TestSampledNotTransient)
+{
+	xerxzema::World world;
+	auto ns = world.get_namespace("test");
+	auto program_str =
+R"EOF(
+prog foo(x:real) -> y:real
+{
+	x + 2.0 -> y;
+}
+)EOF";
+	xerxzema::parse_input(program_str, ns);
+	auto p = ns->get_program("foo");
+
+	xerxzema::Optimizer opt(p);
+	opt.run();
+
+	ASSERT_EQ(opt.get_transient_register_count(), 0);
+}
+
+TEST(TestOptimizer, TestTransientCodeGen)
+{
+	xerxzema::World world;
+	auto ns = world.get_namespace("test");
+	auto program_str =
+R"EOF(
+prog foo(x:real) -> y:real
+{
+	x * x -> t;
+	x * 3.0 -> unused;
+	t * t -> y;
+}
+)EOF";
+	xerxzema::parse_input(program_str, ns);
+	world.jit()->compile_namespace(ns);
+	auto p = ns->get_program("foo");
+	ASSERT_TRUE(p->reg("t")->is_transient());
+	ASSERT_EQ(p->instruction_listing().size(), 2);
+
+	xerxzema::JitInvoke<double, double> invoker(world.jit(), p);
+	ASSERT_EQ(invoker(2), 16);
+	ASSERT_EQ(invoker(3), 81);
+}
+
+TEST(TestOptimizer, TestFoldConstants)
+{
+	xerxzema::World world;
+	auto ns = world.get_namespace("test");
+	auto program_str =
+R"EOF(
+prog foo(x:real) -> y:real
+{
+	x + 2.0 * 3.0 -> y;
+}
+)EOF";
+	xerxzema::parse_input(program_str, ns);
+	auto p = ns->get_program("foo");
+
+	xerxzema::Optimizer opt(p);
+	opt.run();
+
+	ASSERT_EQ(opt.get_folded_instruction_count(), 1);
+	ASSERT_EQ(p->instruction_listing().size(), 2);
+	ASSERT_EQ(p->instruction_listing()[0]->name(), "value_real");
+	ASSERT_EQ(p->instruction_listing()[0]->constant_description(), std::to_string(6.0));
+}
+
+TEST(TestOptimizer, TestCommonSubexpression)
+{
+	xerxzema::World world;
+	auto ns = world.get_namespace("test");
+	auto program_str =
+R"EOF(
+prog foo(a:real, b:real) -> y:real
+{
+	a * b -> t0;
+	a * b -> t1;
+	t0 + t1 -> y;
+}
+)EOF";
+	xerxzema::parse_input(program_str, ns);
+	auto p = ns->get_program("foo");
+
+	xerxzema::Optimizer opt(p);
+	opt.run();
+
+	ASSERT_EQ(opt.get_merged_instruction_count(), 1);
+	ASSERT_EQ(p->instruction_listing().size(), 2);
+	ASSERT_EQ(p->reg("t1")->activations.size(), 0);
+}
+
+TEST(TestOptimizer, TestFoldAndMergeCodeGen)
+{
+	xerxzema::World world;
+	auto ns = world.get_namespace("test");
+	auto program_str =
+R"EOF(
+prog foo(a:real, b:real) -> y:real
+{
+	a * b + a * b + 2.0 * 3.0 -> y;
+}
+)EOF";
+	xerxzema::parse_input(program_str, ns);
+	world.jit()->compile_namespace(ns);
+	auto p = ns->get_program("foo");
+
+	xerxzema::JitInvoke<double, double, double> invoker(world.jit(), p);
+	ASSERT_EQ(invoker(2, 3), 18);
+}
+
+TEST(TestOptimizer, TestFuseChain)
+{
+	xerxzema::World world;
+	auto ns = world.get_namespace("test");
+	auto program_str =
+R"EOF(
+prog foo(a:real, b:real, c:real) -> y:real
+{
+	a * b + c -> y;
+}
+)EOF";
+	xerxzema::parse_input(program_str, ns);
+	auto p = ns->get_program("foo");
+
+	xerxzema::Optimizer opt(p);
+	opt.run();
+
+	ASSERT_EQ(opt.get_fused_instruction_count(), 1);
+	ASSERT_EQ(p->instruction_listing().size(), 1);
+	ASSERT_EQ(p->instruction_listing()[0]->name(), "fused_real");
+	ASSERT_EQ(p->instruction_listing()[0]->constant_description(), "(add (mul $0 $1) $2)");
+	ASSERT_EQ(p->reg("a")->activations.size(), 1);
+	ASSERT_EQ(p->reg("c")->activations.size(), 1);
+}
+
+TEST(TestOptimizer, TestFuseSharedNotFused)
+{
+	xerxzema::World world;
+	auto ns = world.get_namespace("test");
+	auto program_str =
+R"EOF(
+prog foo(a:real, b:real) -> y:real
+{
+	a * b -> t;
+	t + t -> y;
+}
+)EOF";
+	xerxzema::parse_input(program_str, ns);
+	auto p = ns->get_program("foo");
+
+	xerxzema::Optimizer opt(p);
+	opt.run();
+
+	ASSERT_EQ(opt.get_fused_instruction_count(), 0);
+	ASSERT_EQ(p->instruction_listing().size(), 2);
+}
+
+TEST(TestOptimizer, TestFusePolynomialCodeGen)
+{
+	xerxzema::World world;
+	auto ns = world.get_namespace("test");
+	auto program_str =
+R"EOF(
+prog poly(x:real) -> y:real
+{
+	x * x * x * 0.5 + x * 0.25 + 1.0 -> y;
+}
+prog mix(a:real, g:real) -> y:real
+{
+	a * g + a * (1.0 - g) -> y;
+}
+)EOF";
+	xerxzema::parse_input(program_str, ns);
+	world.jit()->compile_namespace(ns);
+
+	auto poly = ns->get_program("poly");
+	ASSERT_EQ(poly->instruction_listing().size(), 4);
+	xerxzema::JitInvoke<double, double> poly_invoker(world.jit(), poly);
+	ASSERT_EQ(poly_invoker(2), 5.5);
+	ASSERT_EQ(poly_invoker(4), 34);
+
+	auto mix = ns->get_program("mix");
+	xerxzema::JitInvoke<double, double, double> mix_invoker(world.jit(), mix);
+	ASSERT_EQ(mix_invoker(4, 0.25), 4);
+}
+
+TEST(TestOptimizer, TestFoldIntConstants)
+{
+	xerxzema::World world;
+	auto p = world.get_namespace("core")->get_program("test");
+	p->add_input("hi", world.get_namespace("core")->type("int"));
+	p->add_output("bye", world.get_namespace("core")->type("int"));
+
+	auto a = p->constant_int(7);
+	auto b = p->constant_int(-2);
+	auto t = p->temp_reg();
+	p->instruction("div", {a, b}, {t});
+	p->instruction("add", {p->reg_data("hi"), xerxzema::RegisterData({t.reg, true})}, {p->reg_data("bye")});
+
+	xerxzema::Optimizer opt(p);
+	opt.run();
+
+	ASSERT_EQ(opt.get_folded_instruction_count(), 1);
+	bool found = false;
+	for(auto& inst: p->instruction_listing())
+	{
+		if(inst->name() == "value_int" && inst->constant_description() == "-3")
+			found = true;
+	}
+	ASSERT_TRUE(found);
+}
+
+TEST(TestOptimizer, TestFoldConstantArray)
+{
+	xerxzema::World world;
+	auto ns = world.get_namespace("test");
+	auto program_str =
+R"EOF(
+prog foo(x:real) -> y:real
+{
+	[1.0, 2.0, 0.5] -> c;
+	[x, 2.0] -> v;
+	sum(c) + sum(v) -> y;
+}
+)EOF";
+	xerxzema::parse_input(program_str, ns);
+	auto p = ns->get_program("foo");
+
+	xerxzema::Optimizer opt(p);
+	opt.fold_constants();
+
+	size_t literals = 0;
+	size_t builders = 0;
+	for(auto& inst: p->instruction_listing())
+	{
+		if(inst->name() == "value_array")
+		{
+			ASSERT_EQ(inst->constant_description(), "1 2 0.5");
+			literals++;
+		}
+		if(inst->name() == "array_builder")
+			builders++;
+	}
+	ASSERT_EQ(literals, 1);
+	ASSERT_EQ(builders, 1);
+
+	world.jit()->compile_namespace(ns);
+	xerxzema::JitInvoke<double, double> invoker(world.jit(), p);
+	ASSERT_EQ(invoker(4), 9.5);
+	ASSERT_EQ(invoker(-1), 4.5);
+}
+
+TEST(TestOptimizer, TestLowerConstantPow)
+{
+	xerxzema::World world;
+	auto ns = world.get_namespace("test");
+	ns->float_mode(xerxzema::FloatMode::Fast);
+	auto program_str =
+R"EOF(
+prog foo(x:real) -> y:real
+{
+	x ^ 3.0 + x ^ 0.5 -> y;
+}
+)EOF";
+	xerxzema::parse_input(program_str, ns);
+	auto p = ns->get_program("foo");
+
+	xerxzema::Optimizer opt(p);
+	opt.run();
+
+	ASSERT_EQ(opt.get_lowered_instruction_count(), 1);
+	bool found = false;
+	for(auto& inst: p->instruction_listing())
+	{
+		if(inst->name() == "powi_real" && inst->constant_description() == "3")
+			found = true;
+		ASSERT_FALSE(inst->name() == "value_real" && inst->constant_description() == "3.000000");
+	}
+	ASSERT_TRUE(found);
+}
+
+TEST(TestOptimizer, TestStrictKeepsPow)
+{
+	xerxzema::World world;
+	auto ns = world.get_namespace("test");
+	ns->float_mode(xerxzema::FloatMode::Strict);
+	auto program_str =
+R"EOF(
+prog foo(x:real) -> y:real
+{
+	x ^ 3.0 -> y;
+}
+)EOF";
+	xerxzema::parse_input(program_str, ns);
+	auto p = ns->get_program("foo");
+
+	xerxzema::Optimizer opt(p);
+	opt.run();
+
+	ASSERT_EQ(opt.get_lowered_instruction_count(), 0);
+}
+
+TEST(TestOptimizer, TestFloatModeCodeGen)
+{
+	xerxzema::World world;
+	auto fast = world.get_namespace("fast");
+	fast->float_mode(xerxzema::FloatMode::Fast);
+	auto strict = world.get_namespace("strict");
+	strict->float_mode(xerxzema::FloatMode::Strict);
+	auto program_str =
+R"EOF(
+prog foo(x:real, y:real) -> z:real
+{
+	x ^ 4.0 * y + 1.0 -> z;
+}
+)EOF";
+	xerxzema::parse_input(program_str, fast);
+	xerxzema::parse_input(program_str, strict);
+	world.jit()->compile_namespace(fast);
+	world.jit()->compile_namespace(strict);
+
+	xerxzema::JitInvoke<double, double, double> fast_invoker(world.jit(), fast->get_program("foo"));
+	ASSERT_EQ(fast_invoker(2, 0.5), 9);
+	xerxzema::JitInvoke<double, double, double> strict_invoker(world.jit(), strict->get_program("foo"));
+	ASSERT_EQ(strict_invoker(2, 0.5), 9);
+}
+
+TEST(TestOptimizer, TestSizeConstantDelays)
+{
+	xerxzema::World world;
+	auto ns = world.get_namespace("test");
+	auto program_str =
+R"EOF(
+prog foo(x:real, n:real) -> y:real
+{
+	delay(x, 100.5) -> a;
+	delay(a, n) -> y;
+}
+)EOF";
+	xerxzema::parse_input(program_str, ns);
+	auto p = ns->get_program("foo");
+
+	xerxzema::Optimizer opt(p);
+	opt.run();
+
+	ASSERT_EQ(opt.get_sized_delay_count(), 1);
+	int64_t reserved = -2;
+	for(auto& inst: p->instruction_listing())
+	{
+		if(inst->name() == "delay_line_interp" && inst->inputs()[1]->name() != "n")
+			reserved = static_cast<xerxzema::DelayLine*>(inst.get())->reserved();
+	}
+	ASSERT_EQ(reserved, 101);
+}
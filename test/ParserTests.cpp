@@ -476,3 +476,14 @@ TEST(TestParser, TestWhenBangExpr)
 	ASSERT_EQ(expr->show(), "(bind (when (symbol x)) (symbol z))");
 	ASSERT_EQ(lexer.peek()->type, xerxzema::TokenType::Eof);
 }
+
+TEST(TestParser, TestIntExpr)
+{
+	std::stringstream ss;
+	ss << "(a + 1) % 7 + 2.5";
+	xerxzema::Lexer lexer(ss);
+
+	auto expr = xerxzema::expression(lexer);
+	ASSERT_EQ(expr->show(), "(add (mod (group (add (symbol a) (int 1))) (int 7)) (real 2.5))");
+	ASSERT_EQ(lexer.peek()->type, xerxzema::TokenType::Eof);
+}
@@ -14,6 +14,41 @@ TEST(TestScheduler, TestSingleInitSingle)
 	world.scheduler()->run();
 }
 
+struct DenormalState
+{
+	xerxzema::CallbackState header;
+	double result;
+};
+
+static double halve(double x)
+{
+	volatile double v = x;
+	return v * 0.5;
+}
+
+static void denormal_callback(void* state)
+{
+	((DenormalState*)state)->result = halve(1e-310);
+}
+
+TEST(TestScheduler, TestFlushDenormals)
+{
+	xerxzema::World world;
+	auto scheduler = world.scheduler();
+	xerxzema::SchedulerConfig config;
+	config.flush_denormals = true;
+	scheduler->configure(config);
+	scheduler->exit_when_empty();
+	DenormalState state{};
+	state.result = 1;
+	scheduler->schedule(denormal_callback, &state, 0);
+	scheduler->run();
+
+	ASSERT_EQ(state.result, 0.0);
+	//the thread that called run gets its old mode back
+	ASSERT_NE(halve(1e-310), 0.0);
+}
+
 TEST(TestScheduler, TestInitMulti)
 {
 	xerxzema::World world;
@@ -29,3 +64,420 @@ TEST(TestScheduler, TestInitMultiSignalLater)
 	world.scheduler()->shutdown();
 	world.scheduler()->wait();
 }
+
+static void count_callback(void* state)
+{
+	auto s = (xerxzema::CallbackState*)state;
+	s->ref_count++;
+}
+
+TEST(TestScheduler, TestMetrics)
+{
+	xerxzema::World world;
+	xerxzema::CallbackState state{};
+	auto scheduler = world.scheduler();
+	scheduler->exit_when_empty();
+	scheduler->schedule(count_callback, &state, 0);
+	scheduler->schedule(count_callback, &state, 10);
+	scheduler->schedule(count_callback, &state, 20);
+	scheduler->run();
+
+	auto& metrics = world.scheduler_metrics();
+	ASSERT_EQ(state.ref_count, 3u);
+	//callbacks see the time they were scheduled for
+	ASSERT_EQ(state.exec_time, 20u);
+	ASSERT_EQ(metrics.total_events.load(), 3u);
+	ASSERT_EQ(metrics.execution.count(), 3u);
+	ASSERT_EQ(metrics.lateness.count(), 3u);
+	ASSERT_GE(metrics.queue_depth.count(), 1u);
+}
+
+struct PeriodicState
+{
+	xerxzema::CallbackState header;
+	xerxzema::Scheduler* scheduler;
+	uint64_t ticks[5];
+	int count;
+};
+
+static void periodic_callback(void* state)
+{
+	auto s = (PeriodicState*)state;
+	if(s->count < 5)
+		s->ticks[s->count++] = s->header.exec_time;
+	else
+		s->scheduler->shutdown();
+}
+
+TEST(TestScheduler, TestPeriodic)
+{
+	xerxzema::World world;
+	PeriodicState state{};
+	state.scheduler = world.scheduler();
+	world.scheduler()->schedule_periodic(periodic_callback, &state, 0, 1000);
+	world.scheduler()->run();
+
+	//every tick lands exactly on the grid
+	for(int i = 0; i < 5; i++)
+		ASSERT_EQ(state.ticks[i], i * 1000u);
+}
+
+TEST(TestScheduler, TestCancel)
+{
+	xerxzema::World world;
+	xerxzema::CallbackState state{};
+	xerxzema::CallbackState other{};
+	auto scheduler = world.scheduler();
+	scheduler->exit_when_empty();
+	auto first = scheduler->schedule(count_callback, &state, 0);
+	auto second = scheduler->schedule(count_callback, &state, 10);
+	scheduler->schedule(count_callback, &other, 20);
+	scheduler->schedule_periodic(count_callback, &state, 30, 1000);
+
+	ASSERT_TRUE(scheduler->cancel(second));
+	ASSERT_FALSE(scheduler->cancel(second));
+	ASSERT_FALSE(scheduler->cancel(0));
+	//takes the periodic timer with it, otherwise run would never return
+	scheduler->cancel_state(&state);
+	ASSERT_FALSE(scheduler->cancel(first));
+	//a reused slot doesn't bring the old handle back
+	scheduler->schedule(count_callback, &other, 40);
+	ASSERT_FALSE(scheduler->cancel(second));
+	scheduler->run();
+
+	ASSERT_EQ(state.ref_count, 0u);
+	ASSERT_EQ(other.ref_count, 2u);
+}
+
+struct LaneState
+{
+	xerxzema::CallbackState header;
+	std::string* order;
+	char name;
+};
+
+static void lane_callback(void* state)
+{
+	auto s = (LaneState*)state;
+	*s->order += s->name;
+}
+
+static void schedule_lanes(xerxzema::Scheduler* scheduler, std::vector<LaneState>& states,
+						   std::string& order)
+{
+	//everything is due in the first window, the lanes decide the order
+	for(auto& s: states)
+	{
+		s.order = &order;
+		auto lane = s.name == 'r' ? xerxzema::SchedulerLane::Realtime :
+			s.name == 't' ? xerxzema::SchedulerLane::Timer : xerxzema::SchedulerLane::Background;
+		scheduler->schedule(lane_callback, &s, 0, lane);
+	}
+}
+
+TEST(TestScheduler, TestLanes)
+{
+	xerxzema::World world;
+	auto scheduler = world.scheduler();
+	scheduler->exit_when_empty();
+	std::string order;
+	std::vector<LaneState> states(7);
+	const char names[] = "btbrtrr";
+	for(size_t i = 0; i < states.size(); i++)
+		states[i].name = names[i];
+	schedule_lanes(scheduler, states, order);
+	ASSERT_EQ(scheduler->task_count(xerxzema::SchedulerLane::Realtime), 3u);
+	ASSERT_EQ(scheduler->task_count(xerxzema::SchedulerLane::Background), 2u);
+	scheduler->run();
+	ASSERT_EQ(order, "rrrttbb");
+	ASSERT_EQ(world.scheduler_metrics().lanes[0].lateness.count(), 3u);
+}
+
+TEST(TestScheduler, TestWeightedLanes)
+{
+	xerxzema::World world;
+	auto scheduler = world.scheduler();
+	scheduler->exit_when_empty();
+	scheduler->lane_policy(xerxzema::LanePolicy::Weighted);
+	scheduler->lane_weight(xerxzema::SchedulerLane::Realtime, 2);
+	scheduler->lane_weight(xerxzema::SchedulerLane::Timer, 1);
+	scheduler->lane_weight(xerxzema::SchedulerLane::Background, 1);
+	std::string order;
+	std::vector<LaneState> states(7);
+	const char names[] = "rrrrttb";
+	for(size_t i = 0; i < states.size(); i++)
+		states[i].name = names[i];
+	schedule_lanes(scheduler, states, order);
+	scheduler->run();
+	//background gets its turn before the realtime burst is done
+	ASSERT_EQ(order, "rrtbrrt");
+}
+
+TEST(TestScheduler, TestConfig)
+{
+	xerxzema::World world;
+	auto scheduler = world.scheduler();
+	scheduler->exit_when_empty();
+	xerxzema::SchedulerConfig config;
+	config.cpu = 0;
+	config.prefault = true;
+	config.prefault_stack = 1 << 16;
+	scheduler->configure(config);
+	ASSERT_EQ(scheduler->config().cpu, 0);
+
+	std::vector<char> state(3 * 4096 + 17, 1);
+	xerxzema::prefault(state.data(), state.size(), true);
+	ASSERT_EQ(state.back(), 1);
+
+	cpu_set_t before;
+	pthread_getaffinity_np(pthread_self(), sizeof(before), &before);
+	xerxzema::CallbackState counter{};
+	scheduler->schedule(count_callback, &counter, 0);
+	scheduler->run();
+	ASSERT_EQ(counter.ref_count, 1u);
+
+	//run was called on this thread, it gets its old affinity back
+	cpu_set_t after;
+	pthread_getaffinity_np(pthread_self(), sizeof(after), &after);
+	ASSERT_TRUE(CPU_EQUAL(&before, &after));
+}
+
+struct ChainState
+{
+	xerxzema::CallbackState header;
+	xerxzema::Scheduler* scheduler;
+	std::vector<uint64_t> times;
+};
+
+//reschedules itself from its own exec_time like the schedule instruction does
+static void chain_callback(void* state)
+{
+	auto s = (ChainState*)state;
+	s->times.push_back(s->header.exec_time);
+	if(s->times.size() < 20)
+		s->scheduler->schedule(chain_callback, state, s->header.exec_time + 1000 * s->times.size());
+}
+
+TEST(TestScheduler, TestOffline)
+{
+	std::vector<uint64_t> expected;
+	{
+		xerxzema::World world;
+		ChainState state{};
+		state.scheduler = world.scheduler();
+		world.scheduler()->exit_when_empty();
+		world.scheduler()->schedule(chain_callback, &state, 0);
+		world.scheduler()->run();
+		expected = state.times;
+	}
+
+	xerxzema::World world;
+	ChainState state{};
+	state.scheduler = world.scheduler();
+	world.scheduler()->offline();
+	world.scheduler()->schedule(chain_callback, &state, 0);
+	world.scheduler()->run();
+	ASSERT_EQ(state.times, expected);
+	ASSERT_EQ(world.scheduler()->time(), expected.back());
+}
+
+TEST(TestScheduler, TestOfflineUntil)
+{
+	xerxzema::World world;
+	xerxzema::CallbackState state{};
+	auto scheduler = world.scheduler();
+	//an hour of 1ms ticks, inclusive of both ends
+	scheduler->offline(3600000000000u);
+	scheduler->schedule_periodic(count_callback, &state, 0, 1000000);
+	scheduler->run();
+	ASSERT_EQ(state.ref_count, 3600001u);
+	ASSERT_EQ(scheduler->time(), 3600000000000u);
+}
+
+TEST(TestScheduler, TestCapacity)
+{
+	xerxzema::World world;
+	auto scheduler = world.scheduler();
+	auto& metrics = world.scheduler_metrics();
+	xerxzema::CallbackState states[6] = {};
+	scheduler->capacity(4, xerxzema::OverloadPolicy::Reject, 50);
+
+	ASSERT_EQ(scheduler->submit(count_callback, &states[0], 10), xerxzema::ScheduleStatus::Queued);
+	ASSERT_EQ(scheduler->submit(count_callback, &states[1], 20), xerxzema::ScheduleStatus::Queued);
+	ASSERT_EQ(scheduler->submit(count_callback, &states[2], 30), xerxzema::ScheduleStatus::Pressure);
+	ASSERT_NE(scheduler->schedule(count_callback, &states[3], 40), 0u);
+	ASSERT_EQ(scheduler->schedule(count_callback, &states[4], 50), 0u);
+	ASSERT_EQ(metrics.rejected.load(), 1u);
+	ASSERT_EQ(metrics.pressure.load(), 2u);
+
+	scheduler->capacity(4, xerxzema::OverloadPolicy::DropOldest);
+	ASSERT_EQ(scheduler->submit(count_callback, &states[4], 50), xerxzema::ScheduleStatus::Dropped);
+
+	scheduler->capacity(4, xerxzema::OverloadPolicy::Coalesce);
+	scheduler->exit_when_empty();
+	ASSERT_EQ(scheduler->submit(count_callback, &states[2], 5), xerxzema::ScheduleStatus::Coalesced);
+	ASSERT_EQ(scheduler->submit(count_callback, &states[5], 60), xerxzema::ScheduleStatus::Rejected);
+	ASSERT_EQ(scheduler->task_count(xerxzema::SchedulerLane::Timer), 4u);
+	ASSERT_EQ(metrics.dropped.load(), 1u);
+	ASSERT_EQ(metrics.coalesced.load(), 1u);
+	scheduler->run();
+
+	//0 made room for 4, 2 ran once at the earlier deadline and 5 never fit
+	ASSERT_EQ(states[0].ref_count, 0u);
+	ASSERT_EQ(states[2].ref_count, 1u);
+	ASSERT_EQ(states[2].exec_time, 5u);
+	ASSERT_EQ(states[4].ref_count, 1u);
+	ASSERT_EQ(states[5].ref_count, 0u);
+}
+
+TEST(TestScheduler, TestDropLowest)
+{
+	xerxzema::World world;
+	auto scheduler = world.scheduler();
+	xerxzema::CallbackState realtime{};
+	xerxzema::CallbackState timer{};
+	xerxzema::CallbackState background{};
+	scheduler->exit_when_empty();
+	scheduler->capacity(1, xerxzema::OverloadPolicy::DropLowest);
+	scheduler->submit(count_callback, &timer, 0);
+	//nothing at or below background to drop
+	ASSERT_EQ(scheduler->submit(count_callback, &background, 0, 0,
+								xerxzema::SchedulerLane::Background),
+			  xerxzema::ScheduleStatus::Rejected);
+	ASSERT_EQ(scheduler->submit(count_callback, &realtime, 0, 0,
+								xerxzema::SchedulerLane::Realtime),
+			  xerxzema::ScheduleStatus::Dropped);
+	scheduler->run();
+	ASSERT_EQ(realtime.ref_count, 1u);
+	ASSERT_EQ(timer.ref_count, 0u);
+	ASSERT_EQ(background.ref_count, 0u);
+}
+
+struct ProducedState
+{
+	xerxzema::CallbackState header;
+	std::atomic<int> count;
+};
+
+static void produced_callback(void* state)
+{
+	((ProducedState*)state)->count++;
+}
+
+TEST(TestScheduler, TestSubmitLocal)
+{
+	xerxzema::World world;
+	auto scheduler = world.scheduler();
+	ProducedState state{};
+	scheduler->run_async();
+
+	//more than a buffer's worth per thread so the locked fallback gets used too
+	std::vector<std::thread> threads;
+	for(int t = 0; t < 8; t++)
+	{
+		threads.emplace_back([scheduler, &state]()
+		{
+			for(int i = 0; i < 1000; i++)
+			{
+				auto status = scheduler->submit_local(produced_callback, &state, i);
+				ASSERT_NE(status, xerxzema::ScheduleStatus::Rejected);
+			}
+		});
+	}
+	for(auto& t: threads)
+		t.join();
+
+	while(state.count.load() < 8000)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	scheduler->shutdown();
+	scheduler->wait();
+	ASSERT_EQ(state.count.load(), 8000);
+	ASSERT_EQ(scheduler->task_count(xerxzema::SchedulerLane::Timer), 0u);
+}
+
+TEST(TestScheduler, TestSubmitLocalLane)
+{
+	xerxzema::World world;
+	auto scheduler = world.scheduler();
+	scheduler->exit_when_empty();
+	ProducedState state{};
+	scheduler->submit_local(produced_callback, &state, 0, xerxzema::SchedulerLane::Realtime);
+	ASSERT_EQ(scheduler->task_count(xerxzema::SchedulerLane::Realtime), 1u);
+	ASSERT_EQ(scheduler->task_count(xerxzema::SchedulerLane::Timer), 0u);
+	scheduler->run();
+	ASSERT_EQ(state.count.load(), 1);
+}
+
+TEST(TestScheduler, TestSubmitLocalCapacity)
+{
+	xerxzema::World world;
+	auto scheduler = world.scheduler();
+	ProducedState states[5] = {};
+	scheduler->capacity(4, xerxzema::OverloadPolicy::Reject, 50);
+
+	//a bounded queue answers with the policy's result, not the buffer's fill
+	ASSERT_EQ(scheduler->submit_local(produced_callback, &states[0], 10),
+			  xerxzema::ScheduleStatus::Queued);
+	ASSERT_EQ(scheduler->submit_local(produced_callback, &states[1], 20),
+			  xerxzema::ScheduleStatus::Queued);
+	ASSERT_EQ(scheduler->submit_local(produced_callback, &states[2], 30),
+			  xerxzema::ScheduleStatus::Pressure);
+	ASSERT_EQ(scheduler->submit_local(produced_callback, &states[3], 40),
+			  xerxzema::ScheduleStatus::Pressure);
+	ASSERT_EQ(scheduler->submit_local(produced_callback, &states[4], 50),
+			  xerxzema::ScheduleStatus::Rejected);
+
+	scheduler->capacity(4, xerxzema::OverloadPolicy::Coalesce);
+	ASSERT_EQ(scheduler->submit_local(produced_callback, &states[0], 5),
+			  xerxzema::ScheduleStatus::Coalesced);
+	ASSERT_EQ(scheduler->task_count(xerxzema::SchedulerLane::Timer), 4u);
+}
+
+static void slow_callback(void* state)
+{
+	auto s = (xerxzema::CallbackState*)state;
+	s->ref_count++;
+	std::this_thread::sleep_for(std::chrono::microseconds(500));
+}
+
+TEST(TestScheduler, TestBudget)
+{
+	xerxzema::World world;
+	auto scheduler = world.scheduler();
+	xerxzema::CallbackState slow{};
+	xerxzema::CallbackState fast{};
+	xerxzema::SchedulerConfig config;
+	config.watchdog = 100000;
+	scheduler->configure(config);
+	scheduler->budget(&slow, "slow", 100000);
+	scheduler->budget(&fast, "fast", 100000000);
+	scheduler->demote_after(3);
+	scheduler->offline(9000);
+	scheduler->schedule_periodic(slow_callback, &slow, 0, 1000);
+	scheduler->schedule_periodic(count_callback, &fast, 0, 1000);
+	scheduler->run();
+
+	ASSERT_EQ(slow.ref_count, 10u);
+	ASSERT_EQ(fast.ref_count, 10u);
+	ASSERT_EQ(world.scheduler_metrics().overruns.load(), 10u);
+	for(auto& b: scheduler->budgets())
+	{
+		if(b.name == "slow")
+		{
+			ASSERT_EQ(b.runs, 10u);
+			ASSERT_EQ(b.overruns, 10u);
+			ASSERT_GE(b.worst, 500000u);
+			ASSERT_TRUE(b.demoted);
+		}
+		else
+		{
+			ASSERT_EQ(b.overruns, 0u);
+			ASSERT_FALSE(b.demoted);
+		}
+	}
+	//the periodic timer went with the program
+	ASSERT_EQ(scheduler->task_count(xerxzema::SchedulerLane::Background), 1u);
+	ASSERT_EQ(scheduler->task_count(xerxzema::SchedulerLane::Timer), 1u);
+	scheduler->cancel_state(&slow);
+	ASSERT_EQ(scheduler->budgets().size(), 1u);
+}
@@ -0,0 +1,76 @@
+#include <gtest/gtest.h>
+#include <stdio.h>
+#include <thread>
+#include "../lib/TraceLog.h"
+
+static std::string read_file(FILE* file)
+{
+	std::string contents;
+	char buffer[256];
+	rewind(file);
+	while(fgets(buffer, sizeof(buffer), file))
+		contents += buffer;
+	return contents;
+}
+
+TEST(TestTraceLog, TestFormat)
+{
+	auto file = tmpfile();
+	xerxzema::TraceLog log(false);
+	log.output(file);
+	auto x = log.site("foo", "x");
+	auto s = log.site("foo", "s");
+	ASSERT_EQ(log.site("foo", "x"), x);
+
+	log.trace_real(x, 1.5);
+	const char text[] = "hello";
+	log.trace_string(s, text, sizeof(text));
+	ASSERT_EQ(log.drain(), 2u);
+	ASSERT_EQ(log.drain(), 0u);
+	ASSERT_EQ(log.written(), 2u);
+	ASSERT_EQ(read_file(file), "(x) 1.500000\n(s) hello\n");
+	//the same register name in another program is a site of its own
+	ASSERT_NE(log.site("bar", "x"), x);
+	fclose(file);
+}
+
+TEST(TestTraceLog, TestThreads)
+{
+	auto file = tmpfile();
+	xerxzema::TraceLog log(false);
+	log.output(file);
+	auto x = log.site("foo", "x");
+
+	//each thread gets its own buffer so nothing is lost below the capacity
+	std::vector<std::thread> threads;
+	for(int t = 0; t < 4; t++)
+	{
+		threads.emplace_back([&log, x]()
+		{
+			for(int i = 0; i < 1000; i++)
+				log.trace_real(x, i);
+		});
+	}
+	for(auto& t: threads)
+		t.join();
+	ASSERT_EQ(log.drain(), 4000u);
+	ASSERT_EQ(log.dropped(), 0u);
+	fclose(file);
+}
+
+TEST(TestTraceLog, TestOverflow)
+{
+	auto file = tmpfile();
+	xerxzema::TraceLog log(false);
+	log.output(file);
+	auto x = log.site("foo", "x");
+	for(uint64_t i = 0; i < xerxzema::trace_buffer_capacity + 10; i++)
+		log.trace_real(x, i);
+	ASSERT_EQ(log.dropped(), 10u);
+	ASSERT_EQ(log.drain(), xerxzema::trace_buffer_capacity);
+
+	//draining makes room again
+	log.trace_real(x, 0);
+	ASSERT_EQ(log.drain(), 1u);
+	fclose(file);
+}